@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014, 2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2017-2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * array.c: Array specific functions
  *
@@ -31,6 +31,22 @@
  * performing array operations that change the array such as appending or
  * removing items. this operations may reallocate or memmove the underlying
  * continuous block of memory and hence move the items in memory.
+ *
+ * by default the underlying memory block grows geometrically, so appending
+ * items is amortized O(1). optionally the memory block can be shrunk again if
+ * most of it became unused after removing items. to avoid reallocating over
+ * and over again if the number of items oscillates around a threshold, the
+ * array only shrinks if less than a quarter of its memory is used and then
+ * keeps memory for twice the number of remaining items.
+ *
+ * non-relocatable items can optionally be packed into chunks instead of
+ * allocating each item individually. each chunk has room for a fixed number of
+ * items and keeps a list of its free slots. an item's slot records the chunk
+ * it belongs to, so an item can be returned to its chunk in O(1). items stay at
+ * a fixed location in memory, but items appended one after another end up next
+ * to each other in memory. a chunk is freed as soon as all its items have been
+ * removed, except for the last chunk that is kept to avoid reallocating it
+ * over and over again if a single item is appended and removed repeatedly.
  */
 
 #include <errno.h>
@@ -41,6 +57,256 @@
 
 #include "macros.h"
 
+#define MIN_AUTO_SHRINK_ALLOCATION 64
+
+typedef union {
+	ArrayChunk *chunk; // chunk this slot belongs to
+	uint64_t align_uint64;
+	double align_double;
+	void *align_pointer;
+} ArraySlotHeader;
+
+struct _ArrayChunk {
+	ArrayChunk *prev; // previous chunk with free slots
+	ArrayChunk *next; // next chunk with free slots
+	int used; // number of used slots
+	uint8_t *free_slot; // first free slot, stores pointer to next free slot
+};
+
+// returns the size of a chunk slot including the slot header, rounded up to
+// keep the items in the following slots aligned
+static int array_get_chunk_slot_size(Array *array) {
+	int size = sizeof(ArraySlotHeader) + MAX(array->size, (int)sizeof(void *));
+
+	return (size + sizeof(ArraySlotHeader) - 1) / sizeof(ArraySlotHeader) * sizeof(ArraySlotHeader);
+}
+
+// returns the size of the chunk header, rounded up to keep the slots aligned
+static int array_get_chunk_header_size(void) {
+	return (sizeof(ArrayChunk) + sizeof(ArraySlotHeader) - 1) / sizeof(ArraySlotHeader) * sizeof(ArraySlotHeader);
+}
+
+static void array_link_free_chunk(Array *array, ArrayChunk *chunk) {
+	chunk->prev = NULL;
+	chunk->next = array->free_chunks;
+
+	if (array->free_chunks != NULL) {
+		array->free_chunks->prev = chunk;
+	}
+
+	array->free_chunks = chunk;
+}
+
+static void array_unlink_free_chunk(Array *array, ArrayChunk *chunk) {
+	if (chunk->prev != NULL) {
+		chunk->prev->next = chunk->next;
+	} else {
+		array->free_chunks = chunk->next;
+	}
+
+	if (chunk->next != NULL) {
+		chunk->next->prev = chunk->prev;
+	}
+}
+
+// allocates a new chunk, puts all its slots into its free slot list and links
+// it into the list of chunks with free slots
+//
+// returns NULL on error (sets errno) or the new chunk on success
+static ArrayChunk *array_allocate_chunk(Array *array) {
+	int slot_size = array_get_chunk_slot_size(array);
+	ArrayChunk *chunk = malloc(array_get_chunk_header_size() + slot_size * array->chunk_length);
+	uint8_t *slot;
+	int i;
+
+	if (chunk == NULL) {
+		errno = ENOMEM;
+
+		return NULL;
+	}
+
+	chunk->used = 0;
+	chunk->free_slot = NULL;
+
+	// link slots in reverse order, so they're handed out in memory order
+	for (i = array->chunk_length - 1; i >= 0; --i) {
+		slot = (uint8_t *)chunk + array_get_chunk_header_size() + slot_size * i;
+
+		((ArraySlotHeader *)slot)->chunk = chunk;
+		*(uint8_t **)(slot + sizeof(ArraySlotHeader)) = chunk->free_slot;
+		chunk->free_slot = slot;
+	}
+
+	array_link_free_chunk(array, chunk);
+
+	++array->chunk_count;
+
+	return chunk;
+}
+
+// allocates the memory for a non-relocatable item, either individually or from
+// a chunk. the memory of the item is initialized to zero.
+//
+// returns NULL on error (sets errno) or a pointer to the item on success
+static void *array_allocate_item(Array *array) {
+	ArrayChunk *chunk;
+	uint8_t *slot;
+	void *item;
+
+	if (array->chunk_length == 0) {
+		item = calloc(1, array->size);
+
+		if (item == NULL) {
+			errno = ENOMEM;
+		}
+
+		return item;
+	}
+
+	chunk = array->free_chunks;
+
+	if (chunk == NULL) {
+		chunk = array_allocate_chunk(array);
+
+		if (chunk == NULL) {
+			return NULL;
+		}
+	}
+
+	slot = chunk->free_slot;
+	item = slot + sizeof(ArraySlotHeader);
+	chunk->free_slot = *(uint8_t **)item;
+
+	if (++chunk->used == array->chunk_length) {
+		array_unlink_free_chunk(array, chunk);
+	}
+
+	memset(item, 0, array->size);
+
+	return item;
+}
+
+// frees the memory of a non-relocatable item, as allocated by
+// array_allocate_item
+static void array_free_item(Array *array, void *item) {
+	uint8_t *slot;
+	ArrayChunk *chunk;
+
+	if (array->chunk_length == 0) {
+		free(item);
+
+		return;
+	}
+
+	slot = (uint8_t *)item - sizeof(ArraySlotHeader);
+	chunk = ((ArraySlotHeader *)slot)->chunk;
+
+	if (chunk->used == array->chunk_length) {
+		array_link_free_chunk(array, chunk);
+	}
+
+	*(uint8_t **)item = chunk->free_slot;
+	chunk->free_slot = slot;
+
+	if (--chunk->used == 0 && array->chunk_count > 1) {
+		array_unlink_free_chunk(array, chunk);
+
+		--array->chunk_count;
+
+		free(chunk);
+	}
+}
+
+// returns the size of a slot in the underlying memory block. for relocatable
+// items this is the item size, otherwise the size of the pointer to the item
+static int array_get_slot_size(Array *array) {
+	return array->relocatable ? array->size : (int)sizeof(void *);
+}
+
+// calls the item destroy function DESTROY (if given) for an ITEM that is about
+// to be removed from the array and frees the item's extra memory (if any)
+static void array_release_item(Array *array, void *item, ItemDestroyFunction destroy) {
+	if (destroy != NULL) {
+		destroy(item);
+	}
+
+	if (!array->relocatable) {
+		array_free_item(array, item);
+	}
+}
+
+// changes the number of allocated items to ALLOCATED (> 0). if the memory
+// block grows then the new memory is initialized to zero.
+//
+// returns -1 on error (sets errno) or 0 on success
+static int array_reallocate(Array *array, int allocated) {
+	int size = array_get_slot_size(array);
+	uint8_t *bytes = realloc(array->bytes, allocated * size);
+
+	if (bytes == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	if (allocated > array->allocated) {
+		memset(bytes + array->allocated * size, 0, (allocated - array->allocated) * size);
+	}
+
+	array->allocated = allocated;
+	array->bytes = bytes;
+
+	return 0;
+}
+
+// ensures that an Array object can store at least COUNT items. in contrast to
+// array_reserve this applies the growth policy of the array.
+//
+// returns -1 on error (sets errno) or 0 on success
+static int array_grow(Array *array, int count) {
+	if (array->allocated >= count) {
+		return 0;
+	}
+
+	if (array->growth == ARRAY_GROWTH_GEOMETRIC) {
+		count = MAX(count, array->allocated + array->allocated / 2);
+	}
+
+	return array_reallocate(array, GROW_ALLOCATION(count));
+}
+
+// gives memory back after items got removed, if auto-shrink is enabled. a
+// failure to shrink is not an error, the array just keeps its memory
+static void array_check_shrink(Array *array) {
+	int allocated;
+
+	if (!array->auto_shrink ||
+	    array->allocated <= MIN_AUTO_SHRINK_ALLOCATION ||
+	    array->count >= array->allocated / 4) {
+		return;
+	}
+
+	allocated = GROW_ALLOCATION(MAX(array->count * 2, MIN_AUTO_SHRINK_ALLOCATION));
+
+	if (allocated < array->allocated) {
+		array_reallocate(array, allocated);
+	}
+}
+
+// releases the items in the range [START, END) as done by array_release_item
+static void array_release_items(Array *array, int start, int end,
+                                ItemDestroyFunction destroy) {
+	int i;
+
+	if (destroy == NULL && array->relocatable) {
+		return;
+	}
+
+	for (i = start; i < end; ++i) {
+		array_release_item(array, array_get(array, i), destroy);
+	}
+}
+
 // creates an empty (count == 0) Array object and reserve memory for the number
 // of items specified by RESERVE (>= 0). each item is SIZE (> 0) bytes in size.
 // if the items to store can be moved in memory then set RELOCATABLE to true,
@@ -55,6 +321,11 @@ int array_create(Array *array, int reserve, int size, bool relocatable) {
 	array->count = 0;
 	array->size = size;
 	array->relocatable = relocatable;
+	array->growth = ARRAY_GROWTH_GEOMETRIC;
+	array->auto_shrink = false;
+	array->chunk_length = 0;
+	array->chunk_count = 0;
+	array->free_chunks = NULL;
 	array->bytes = calloc(reserve, relocatable ? size : (int)sizeof(void *));
 
 	if (array->bytes == NULL) {
@@ -72,28 +343,69 @@ int array_create(Array *array, int reserve, int size, bool relocatable) {
 // function DESTROY is given then it is called for each item in the array (with
 // a pointer to the item as the only parameter) before the memory is freed.
 void array_destroy(Array *array, ItemDestroyFunction destroy) {
-	int i;
-	void *item;
+	ArrayChunk *chunk;
 
-	if (destroy != NULL) {
-		for (i = 0; i < array->count; ++i) {
-			item = array_get(array, i);
+	array_release_items(array, 0, array->count, destroy);
 
-			destroy(item);
+	// all items are released, but the last chunk is kept until now
+	while (array->free_chunks != NULL) {
+		chunk = array->free_chunks;
+		array->free_chunks = chunk->next;
 
-			if (!array->relocatable) {
-				free(item);
-			}
-		}
-	} else if (!array->relocatable) {
-		for (i = 0; i < array->count; ++i) {
-			free(array_get(array, i));
-		}
+		free(chunk);
 	}
 
 	free(array->bytes);
 }
 
+// sets the growth policy of an Array object. with ARRAY_GROWTH_GEOMETRIC (the
+// default) the underlying memory block grows by at least 50% each time it has
+// to grow. with ARRAY_GROWTH_LINEAR it only grows to the next multiple of 16
+// items, this saves memory for small arrays that grow slowly.
+void array_set_growth(Array *array, ArrayGrowth growth) {
+	array->growth = growth;
+}
+
+// enables or disables automatic shrinking of the underlying memory block of an
+// Array object after items got removed. this is useful for arrays that are
+// temporarily much bigger than usual. auto-shrink is disabled by default.
+void array_set_auto_shrink(Array *array, bool auto_shrink) {
+	array->auto_shrink = auto_shrink;
+
+	array_check_shrink(array);
+}
+
+// enables chunked storage for the items of a non-relocatable Array object.
+// instead of allocating memory for each item individually, the items are
+// packed into chunks of CHUNK_LENGTH (> 0) items. this reduces the number of
+// allocations and improves locality when iterating over the items. setting
+// CHUNK_LENGTH to 0 disables chunked storage again. the chunk length can only
+// be changed while the array is empty.
+//
+// returns -1 on error (sets errno) or 0 on success
+int array_set_chunk_length(Array *array, int chunk_length) {
+	ArrayChunk *chunk;
+
+	if (array->relocatable || array->count > 0 || chunk_length < 0) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	// an empty array might still have its last chunk
+	while (array->free_chunks != NULL) {
+		chunk = array->free_chunks;
+		array->free_chunks = chunk->next;
+
+		free(chunk);
+	}
+
+	array->chunk_length = chunk_length;
+	array->chunk_count = 0;
+
+	return 0;
+}
+
 // ensures that an Array object's underlying memory block can store at least
 // the number of items specified by RESERVE (>= 0). this is useful if a larger
 // number of items should be appended to the array, because if enough memory
@@ -102,28 +414,25 @@ void array_destroy(Array *array, ItemDestroyFunction destroy) {
 //
 // returns -1 on error (sets errno) or 0 on success
 int array_reserve(Array *array, int reserve) {
-	int size = array->relocatable ? array->size : (int)sizeof(void *);
-	uint8_t *bytes;
-
 	if (array->allocated >= reserve) {
 		return 0;
 	}
 
-	reserve = GROW_ALLOCATION(reserve);
-	bytes = realloc(array->bytes, reserve * size);
+	return array_reallocate(array, GROW_ALLOCATION(reserve));
+}
 
-	if (bytes == NULL) {
-		errno = ENOMEM;
+// shrinks an Array object's underlying memory block to the number of stored
+// items.
+//
+// returns -1 on error (sets errno) or 0 on success
+int array_shrink_to_fit(Array *array) {
+	int allocated = MAX(array->count, 1);
 
-		return -1;
+	if (array->allocated == allocated) {
+		return 0;
 	}
 
-	memset(bytes + array->allocated * size, 0, (reserve - array->allocated) * size);
-
-	array->allocated = reserve;
-	array->bytes = bytes;
-
-	return 0;
+	return array_reallocate(array, allocated);
 }
 
 // resizes an Array object to the number of items given by COUNT (>= 0). if
@@ -138,9 +447,10 @@ int array_resize(Array *array, int count, ItemDestroyFunction destroy) {
 	int rc;
 	int i;
 	void *item;
+	int size = array_get_slot_size(array);
 
 	if (array->count < count) { // grow
-		rc = array_reserve(array, count);
+		rc = array_grow(array, count);
 
 		if (rc < 0) {
 			return rc;
@@ -148,14 +458,15 @@ int array_resize(Array *array, int count, ItemDestroyFunction destroy) {
 
 		if (!array->relocatable) {
 			for (i = array->count; i < count; ++i) {
-				item = calloc(1, array->size);
+				item = array_allocate_item(array);
 
 				if (item == NULL) {
 					for (--i; i >= array->count; --i) {
-						free(array_get(array, i));
+						array_free_item(array, array_get(array, i));
 					}
 
-					errno = ENOMEM;
+					memset(array->bytes + size * array->count, 0,
+					       (count - array->count) * size);
 
 					return -1;
 				}
@@ -164,21 +475,15 @@ int array_resize(Array *array, int count, ItemDestroyFunction destroy) {
 			}
 		}
 	} else if (array->count > count) { // shrink
-		if (destroy != NULL) {
-			for (i = count; i < array->count; ++i) {
-				item = array_get(array, i);
+		array_release_items(array, count, array->count, destroy);
 
-				destroy(item);
+		memset(array->bytes + size * count, 0, (array->count - count) * size);
 
-				if (!array->relocatable) {
-					free(item);
-				}
-			}
-		} else if (!array->relocatable) {
-			for (i = count; i < array->count; ++i) {
-				free(array_get(array, i));
-			}
-		}
+		array->count = count;
+
+		array_check_shrink(array);
+
+		return 0;
 	}
 
 	array->count = count;
@@ -193,18 +498,16 @@ int array_resize(Array *array, int count, ItemDestroyFunction destroy) {
 void *array_append(Array *array) {
 	void *item;
 
-	if (array_reserve(array, array->count + 1) < 0) {
+	if (array_grow(array, array->count + 1) < 0) {
 		return NULL;
 	}
 
 	if (array->relocatable) {
 		item = array->bytes + array->size * array->count;
 	} else {
-		item = calloc(1, array->size);
+		item = array_allocate_item(array);
 
 		if (item == NULL) {
-			errno = ENOMEM;
-
 			return NULL;
 		}
 
@@ -216,31 +519,125 @@ void *array_append(Array *array) {
 	return item;
 }
 
+// appends COUNT (> 0) new items to the end of an Array object. the memory of
+// these items is initialized to zero. in contrast to calling array_append
+// COUNT times the array grows at most once.
+//
+// returns NULL on error (sets errno) or a pointer to the first new item on
+// success. for relocatable items the new items are continuous in memory, for
+// non-relocatable items use array_get to access the other new items.
+void *array_append_n(Array *array, int count) {
+	int index = array->count;
+
+	if (count <= 0) {
+		errno = EINVAL;
+
+		return NULL;
+	}
+
+	if (array_resize(array, array->count + count, NULL) < 0) {
+		return NULL;
+	}
+
+	return array_get(array, index);
+}
+
 // removes the item at the given INDEX (>= 0 and < count) from an Array object.
 // if an item destroy function DESTROY is given then it is called (with a
 // pointer to the item as the only parameter) before it is removed.
 void array_remove(Array *array, int index, ItemDestroyFunction destroy) {
-	void *item = array_get(array, index);
-	int size = array->relocatable ? array->size : (int)sizeof(void *);
+	array_remove_range(array, index, 1, destroy);
+}
+
+// removes COUNT (>= 0) items starting at the given INDEX (>= 0 and
+// INDEX + COUNT <= count) from an Array object. if an item destroy function
+// DESTROY is given then it is called for each removed item (with a pointer to
+// the item as the only parameter) before it is removed. the items following
+// the range are moved only once.
+void array_remove_range(Array *array, int index, int count, ItemDestroyFunction destroy) {
+	int size = array_get_slot_size(array);
 	int tail;
 
-	if (destroy != NULL) {
-		destroy(item);
+	if (count <= 0) {
+		return;
 	}
 
-	if (!array->relocatable) {
-		free(item);
-	}
+	array_release_items(array, index, index + count, destroy);
 
-	tail = (array->count - index - 1) * size;
+	tail = (array->count - index - count) * size;
 
 	if (tail > 0) {
-		memmove(array->bytes + size * index, array->bytes + size * (index + 1), tail);
+		memmove(array->bytes + size * index, array->bytes + size * (index + count), tail);
 	}
 
-	memset(array->bytes + size * (array->count - 1), 0, size);
+	memset(array->bytes + size * (array->count - count), 0, size * count);
+
+	array->count -= count;
+
+	array_check_shrink(array);
+}
+
+// removes the item at the given INDEX (>= 0 and < count) from an Array object
+// by moving the last item into its place. this does not keep the order of the
+// items, but doesn't need to move all following items. if an item destroy
+// function DESTROY is given then it is called (with a pointer to the item as
+// the only parameter) before it is removed.
+void array_swap_remove(Array *array, int index, ItemDestroyFunction destroy) {
+	int size = array_get_slot_size(array);
+	int last = array->count - 1;
+
+	array_release_item(array, array_get(array, index), destroy);
+
+	if (index < last) {
+		memcpy(array->bytes + size * index, array->bytes + size * last, size);
+	}
+
+	memset(array->bytes + size * last, 0, size);
 
 	--array->count;
+
+	array_check_shrink(array);
+}
+
+// removes all items from an Array object for which the PREDICATE function
+// returns true. the predicate gets called once for each item in order (with a
+// pointer to the item and OPAQUE as parameters). if an item destroy function
+// DESTROY is given then it is called (with a pointer to the item as the only
+// parameter) before an item is removed. the remaining items keep their order
+// and are moved at most once.
+//
+// returns the number of removed items
+int array_remove_if(Array *array, ItemPredicateFunction predicate, void *opaque,
+                    ItemDestroyFunction destroy) {
+	int size = array_get_slot_size(array);
+	int i;
+	int kept = 0;
+	void *item;
+	int removed;
+
+	for (i = 0; i < array->count; ++i) {
+		item = array_get(array, i);
+
+		if (predicate(item, opaque)) {
+			array_release_item(array, item, destroy);
+		} else {
+			if (kept < i) {
+				memcpy(array->bytes + size * kept, array->bytes + size * i, size);
+			}
+
+			++kept;
+		}
+	}
+
+	removed = array->count - kept;
+
+	memset(array->bytes + size * kept, 0, size * removed);
+
+	array->count = kept;
+
+	array_check_shrink(array);
+
+	return removed;
 }
 
 // returns a pointer to the item at the given INDEX (>= 0 and < count)
@@ -254,21 +651,9 @@ void *array_get(Array *array, int index) {
 
 // swaps the content of an Array object with the content of another an Array object
 void array_swap(Array *array, Array *other) {
-	int allocated = other->allocated;
-	int count = other->count;
-	int size = other->size;
-	bool relocatable = other->relocatable;
-	uint8_t *bytes = other->bytes;
-
-	other->allocated = array->allocated;
-	other->count = array->count;
-	other->size = array->size;
-	other->relocatable = array->relocatable;
-	other->bytes = array->bytes;
+	Array tmp;
 
-	array->allocated = allocated;
-	array->count = count;
-	array->size = size;
-	array->relocatable = relocatable;
-	array->bytes = bytes;
+	memcpy(&tmp, other, sizeof(Array));
+	memcpy(other, array, sizeof(Array));
+	memcpy(array, &tmp, sizeof(Array));
 }
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014, 2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2017-2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * array.h: Array specific functions
  *
@@ -27,22 +27,46 @@
 
 #include "utils.h"
 
+typedef bool (*ItemPredicateFunction)(void *item, void *opaque);
+
+typedef enum {
+	ARRAY_GROWTH_GEOMETRIC = 0, // grow by at least 50%
+	ARRAY_GROWTH_LINEAR // grow to the next multiple of 16 items
+} ArrayGrowth;
+
+typedef struct _ArrayChunk ArrayChunk;
+
 typedef struct {
 	int allocated; // number of allocated items
 	int count; // number of stored items
 	int size; // size of a single item in bytes
 	bool relocatable; // true if item can be moved in memory
+	ArrayGrowth growth;
+	bool auto_shrink; // true if memory is given back after removing items
+	int chunk_length; // items per chunk for non-relocatable items, 0 if disabled
+	int chunk_count; // number of allocated chunks
+	ArrayChunk *free_chunks; // chunks with at least one free slot
 	uint8_t *bytes;
 } Array;
 
 int array_create(Array *array, int reserve, int size, bool relocatable);
 void array_destroy(Array *array, ItemDestroyFunction destroy);
 
+void array_set_growth(Array *array, ArrayGrowth growth);
+void array_set_auto_shrink(Array *array, bool auto_shrink);
+int array_set_chunk_length(Array *array, int chunk_length);
+
 int array_reserve(Array *array, int count);
+int array_shrink_to_fit(Array *array);
 int array_resize(Array *array, int count, ItemDestroyFunction destroy);
 
 void *array_append(Array *array);
+void *array_append_n(Array *array, int count);
 void array_remove(Array *array, int i, ItemDestroyFunction destroy);
+void array_remove_range(Array *array, int index, int count, ItemDestroyFunction destroy);
+void array_swap_remove(Array *array, int index, ItemDestroyFunction destroy);
+int array_remove_if(Array *array, ItemPredicateFunction predicate, void *opaque,
+                    ItemDestroyFunction destroy);
 
 void *array_get(Array *array, int i);
 
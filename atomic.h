@@ -0,0 +1,154 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * atomic.h: Atomic operations
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_ATOMIC_H
+#define DAEMONLIB_ATOMIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+#include "macros.h"
+
+// the __atomic builtins are available since GCC 4.7 and in all clang versions
+// that daemonlib supports. for older GCC versions fall back to the __sync
+// builtins that always imply a full memory barrier
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC_PREREQ(4, 7))
+	#define atomic_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+	#define atomic_load_relaxed(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+	#define atomic_store_release(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+	#define atomic_store_relaxed(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+	#define atomic_exchange(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL)
+	#define atomic_fetch_add(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL)
+	#define atomic_compare_exchange(ptr, expected, desired) \
+		__atomic_compare_exchange_n(ptr, expected, desired, false, \
+		                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+	#define atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+	#define atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+#elif defined(__GNUC__)
+	#define atomic_load_acquire(ptr) __sync_fetch_and_add(ptr, 0)
+	#define atomic_load_relaxed(ptr) __sync_fetch_and_add(ptr, 0)
+	#define atomic_store_release(ptr, value) do { __sync_synchronize(); *(ptr) = (value); __sync_synchronize(); } while (0)
+	#define atomic_store_relaxed(ptr, value) atomic_store_release(ptr, value)
+	#define atomic_exchange(ptr, value) ({ __sync_synchronize(); __sync_lock_test_and_set(ptr, value); })
+	#define atomic_fetch_add(ptr, value) __sync_fetch_and_add(ptr, value)
+	#define atomic_compare_exchange(ptr, expected, desired) ({ \
+		typeof(*(expected)) __expected = *(expected); \
+		typeof(*(expected)) __previous = __sync_val_compare_and_swap(ptr, __expected, desired); \
+		*(expected) = __previous; \
+		__previous == __expected; })
+	#define atomic_fence() __sync_synchronize()
+	#define atomic_fence_release() __sync_synchronize()
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	// on x86 and x64 MSVC gives volatile accesses acquire and release semantics
+	// (/volatile:ms is the default there) and aligned loads and stores up to
+	// pointer size are atomic. the read-modify-write operations are mapped to
+	// the Interlocked intrinsics by operand size. needs __typeof__ support,
+	// available since Visual Studio 2022 17.9. on x86 atomic_exchange is limited
+	// to operands of pointer size or smaller
+	#define atomic_load_acquire(ptr) (*(volatile __typeof__(*(ptr)) *)(ptr))
+	#define atomic_load_relaxed(ptr) (*(volatile __typeof__(*(ptr)) *)(ptr))
+	#define atomic_store_release(ptr, value) (*(volatile __typeof__(*(ptr)) *)(ptr) = (value))
+	#define atomic_store_relaxed(ptr, value) (*(volatile __typeof__(*(ptr)) *)(ptr) = (value))
+	#define atomic_exchange(ptr, value) \
+		((__typeof__(*(ptr)))(intptr_t)atomic_exchange_msvc((ptr), (int64_t)(intptr_t)(value), sizeof(*(ptr))))
+	#define atomic_fetch_add(ptr, value) \
+		((__typeof__(*(ptr)))atomic_fetch_add_msvc((ptr), (int64_t)(value), sizeof(*(ptr))))
+	#define atomic_compare_exchange(ptr, expected, desired) \
+		atomic_compare_exchange_msvc((ptr), (expected), (int64_t)(desired), sizeof(*(ptr)))
+	#define atomic_fence() atomic_fence_msvc()
+	#define atomic_fence_release() _ReadWriteBarrier()
+
+	static __forceinline bool atomic_compare_exchange_msvc(volatile void *ptr, void *expected,
+	                                                       int64_t desired, size_t size) {
+		char expected8;
+		long expected32;
+		__int64 expected64;
+
+		switch (size) {
+		case 1:
+			expected8 = *(char *)expected;
+			*(char *)expected = _InterlockedCompareExchange8((volatile char *)ptr, (char)desired, expected8);
+
+			return *(char *)expected == expected8;
+
+		case 4:
+			expected32 = *(long *)expected;
+			*(long *)expected = _InterlockedCompareExchange((volatile long *)ptr, (long)desired, expected32);
+
+			return *(long *)expected == expected32;
+
+		default:
+			expected64 = *(__int64 *)expected;
+			*(__int64 *)expected = _InterlockedCompareExchange64((volatile __int64 *)ptr, desired, expected64);
+
+			return *(__int64 *)expected == expected64;
+		}
+	}
+
+	static __forceinline int64_t atomic_exchange_msvc(volatile void *ptr, int64_t value, size_t size) {
+		__int64 previous;
+
+		switch (size) {
+		case 1:
+			return _InterlockedExchange8((volatile char *)ptr, (char)value);
+
+		case 4:
+			return _InterlockedExchange((volatile long *)ptr, (long)value);
+
+		default:
+			// x86 has no 64-bit exchange intrinsic, use a compare-and-swap loop
+			do {
+				previous = *(volatile __int64 *)ptr;
+			} while (_InterlockedCompareExchange64((volatile __int64 *)ptr, value, previous) != previous);
+
+			return previous;
+		}
+	}
+
+	static __forceinline int64_t atomic_fetch_add_msvc(volatile void *ptr, int64_t value, size_t size) {
+		__int64 previous;
+
+		if (size == 4) {
+			return _InterlockedExchangeAdd((volatile long *)ptr, (long)value);
+		}
+
+		// x86 has no 64-bit add intrinsic, use a compare-and-swap loop
+		do {
+			previous = *(volatile __int64 *)ptr;
+		} while (_InterlockedCompareExchange64((volatile __int64 *)ptr, previous + value, previous) != previous);
+
+		return previous;
+	}
+
+	static __forceinline void atomic_fence_msvc(void) {
+		volatile long barrier = 0;
+
+		_InterlockedExchange(&barrier, 0); // locked instructions are full barriers
+	}
+#else
+	#error Atomic operations are not supported for this compiler
+#endif
+
+#endif // DAEMONLIB_ATOMIC_H
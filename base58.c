@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * base58.c: Base58 functions
  *
@@ -24,71 +24,135 @@
 
 #include "base58.h"
 
-static const char *_base58_alphabet =
+#include "macros.h"
+
+#define CACHE_SIZE 64 // must be a power of two
+
+typedef struct {
+	uint32_t value;
+	char base58[BASE58_MAX_LENGTH]; // empty if the entry is unused
+} Base58CacheEntry;
+
+#ifdef THREAD_LOCAL
+static THREAD_LOCAL Base58CacheEntry _cache[CACHE_SIZE];
+#endif
+
+static const char _base58_alphabet[59] =
 	"123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ";
 
+// maps a character to its digit value, 0xFF for characters not in the alphabet
+#define X 0xFF
+
+static const uint8_t _base58_digits[256] = {
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0x00
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0x10
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0x20
+	X, 0, 1, 2, 3, 4, 5, 6, 7, 8, X, X, X, X, X, X, // 0x30 '1'-'9'
+	X, 34, 35, 36, 37, 38, 39, 40, 41, X, 42, 43, 44, 45, 46, X, // 0x40 'A'-'O'
+	47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, X, X, X, X, X, // 0x50 'P'-'Z'
+	X, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, X, 20, 21, 22, // 0x60 'a'-'o'
+	23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, X, X, X, X, X, // 0x70 'p'-'z'
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0x80
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0x90
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0xA0
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0xB0
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0xC0
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0xD0
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 0xE0
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X  // 0xF0
+};
+#undef X
+
 char *base58_encode(char *base58, uint32_t value) {
-	uint32_t digit;
-	char reverse[BASE58_MAX_LENGTH];
-	int i = 0;
-	int k = 0;
-
-	while (value >= 58) {
-		digit = value % 58;
-		reverse[i] = _base58_alphabet[digit];
-		value = value / 58;
-		++i;
+	char buffer[BASE58_MAX_LENGTH];
+	int i = BASE58_MAX_LENGTH - 1;
+	uint32_t quotient;
+	uint32_t pair;
+
+	buffer[i] = '\0';
+
+	// fill the buffer from its end to avoid reversing the digits afterwards.
+	// produce two digits per division, the compiler turns the divisions by
+	// constants into multiplications
+	while (value >= 58 * 58) {
+		quotient = value / (58 * 58);
+		pair = value - quotient * (58 * 58);
+		buffer[--i] = _base58_alphabet[pair % 58];
+		buffer[--i] = _base58_alphabet[pair / 58];
+		value = quotient;
 	}
 
-	reverse[i] = _base58_alphabet[value];
-
-	for (k = 0; k <= i; ++k) {
-		base58[k] = reverse[i - k];
+	if (value >= 58) {
+		buffer[--i] = _base58_alphabet[value % 58];
+		value /= 58;
 	}
 
-	for (; k < BASE58_MAX_LENGTH; ++k) {
-		base58[k] = '\0';
-	}
+	buffer[--i] = _base58_alphabet[value];
+
+	memcpy(base58, buffer + i, BASE58_MAX_LENGTH - i);
+	memset(base58 + BASE58_MAX_LENGTH - i, 0, i);
 
 	return base58;
 }
 
 // sets errno on error
 int base58_decode(uint32_t *value, const char *base58) {
-	int i;
-	const char *p;
-	int k;
-	uint32_t base = 1;
+	const char *p = base58;
+	uint8_t digit;
+	uint64_t result = 0;
 
 	*value = 0;
-	i = strlen(base58) - 1;
 
-	if (i < 0) {
+	if (*p == '\0') {
 		errno = EINVAL;
 
 		return -1;
 	}
 
-	for (; i >= 0; --i) {
-		p = strchr(_base58_alphabet, base58[i]);
+	for (; *p != '\0'; ++p) {
+		digit = _base58_digits[(uint8_t)*p];
 
-		if (p == NULL) {
+		if (digit == 0xFF) {
 			errno = EINVAL;
 
 			return -1;
 		}
 
-		k = p - _base58_alphabet;
+		result = result * 58 + digit;
 
-		if (*value > UINT32_MAX - k * base) {
+		if (result > UINT32_MAX) {
 			errno = ERANGE;
 
 			return -1;
 		}
-
-		*value += k * base;
-		base *= 58;
 	}
 
+	*value = (uint32_t)result;
+
 	return 0;
 }
+
+// same as base58_encode, but looks the value up in a small direct-mapped cache
+// first. the same few UIDs are encoded over and over again for packet
+// signatures, so this mostly turns encoding into a lookup. the cache is
+// thread-local, therefore no locking is required.
+char *base58_encode_cached(char *base58, uint32_t value) {
+#ifdef THREAD_LOCAL
+	// Fibonacci hashing spreads consecutive UIDs over the cache
+	Base58CacheEntry *entry = &_cache[(value * 2654435761u) >> 26];
+
+	STATIC_ASSERT(CACHE_SIZE == 1 << (32 - 26), "CACHE_SIZE and hash shift mismatch");
+
+	if (entry->value != value || entry->base58[0] == '\0') {
+		entry->value = value;
+
+		base58_encode(entry->base58, value);
+	}
+
+	memcpy(base58, entry->base58, BASE58_MAX_LENGTH);
+
+	return base58;
+#else
+	return base58_encode(base58, value);
+#endif
+}
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * base58.h: Base58 functions
  *
@@ -29,4 +29,6 @@
 char *base58_encode(char *base58, uint32_t value);
 int base58_decode(uint32_t *value, const char *base58);
 
+char *base58_encode_cached(char *base58, uint32_t value);
+
 #endif // DAEMONLIB_BASE58_H
@@ -0,0 +1,243 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * base58_benchmark.c: Compares the base58 encoder and decoder with the old ones
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * standalone micro-benchmark for base58.c, it is not part of any daemon:
+ *
+ *   gcc -O2 -o base58_benchmark base58_benchmark.c base58.c
+ *   ./base58_benchmark [<iterations>]
+ *
+ * first both implementations are cross-checked, then each function is timed
+ * over the given number of calls (default 50000000), three runs each. the old
+ * implementations are the ones base58.c had before the lookup table and the
+ * two digits per division change. they are kept out-of-line, so that they
+ * are not favored over base58.c by getting inlined into the timing loops.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base58.h"
+
+#define DEFAULT_ITERATIONS 50000000
+#define CHECK_COUNT 2000000
+#define RUN_COUNT 3
+
+// multiplying by an odd constant scrambles the loop counter over the whole
+// 32-bit range, so the benchmark covers UIDs of all lengths
+#define SCRAMBLE(i) ((uint32_t)(i) * 2654435761u)
+
+static const char *_old_base58_alphabet =
+	"123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ";
+
+static volatile uint32_t _sink;
+
+__attribute__((noinline))
+static char *old_base58_encode(char *base58, uint32_t value) {
+	uint32_t digit;
+	char reverse[BASE58_MAX_LENGTH];
+	int i = 0;
+	int k = 0;
+
+	while (value >= 58) {
+		digit = value % 58;
+		reverse[i] = _old_base58_alphabet[digit];
+		value = value / 58;
+		++i;
+	}
+
+	reverse[i] = _old_base58_alphabet[value];
+
+	for (k = 0; k <= i; ++k) {
+		base58[k] = reverse[i - k];
+	}
+
+	for (; k < BASE58_MAX_LENGTH; ++k) {
+		base58[k] = '\0';
+	}
+
+	return base58;
+}
+
+// sets errno on error
+__attribute__((noinline))
+static int old_base58_decode(uint32_t *value, const char *base58) {
+	int i;
+	const char *p;
+	int k;
+	uint32_t base = 1;
+
+	*value = 0;
+	i = strlen(base58) - 1;
+
+	if (i < 0) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	for (; i >= 0; --i) {
+		p = strchr(_old_base58_alphabet, base58[i]);
+
+		if (p == NULL) {
+			errno = EINVAL;
+
+			return -1;
+		}
+
+		k = p - _old_base58_alphabet;
+
+		if (*value > UINT32_MAX - k * base) {
+			errno = ERANGE;
+
+			return -1;
+		}
+
+		*value += k * base;
+		base *= 58;
+	}
+
+	return 0;
+}
+
+static uint64_t nanoseconds(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// returns 0 if both implementations agree on CHECK_COUNT values, -1 otherwise
+static int check(void) {
+	uint32_t i;
+	uint32_t value;
+	uint32_t decoded;
+	char old_base58[BASE58_MAX_LENGTH];
+	char new_base58[BASE58_MAX_LENGTH];
+
+	for (i = 0; i < CHECK_COUNT; ++i) {
+		value = SCRAMBLE(i);
+
+		old_base58_encode(old_base58, value);
+		base58_encode(new_base58, value);
+
+		if (memcmp(old_base58, new_base58, BASE58_MAX_LENGTH) != 0) {
+			fprintf(stderr, "encode mismatch for %" PRIu32 ": %s != %s\n",
+			        value, old_base58, new_base58);
+
+			return -1;
+		}
+
+		if (base58_decode(&decoded, new_base58) < 0 || decoded != value) {
+			fprintf(stderr, "decode mismatch for %s: %" PRIu32 " != %" PRIu32 "\n",
+			        new_base58, decoded, value);
+
+			return -1;
+		}
+
+		if (old_base58_decode(&decoded, old_base58) < 0 || decoded != value) {
+			fprintf(stderr, "old decode mismatch for %s: %" PRIu32 " != %" PRIu32 "\n",
+			        old_base58, decoded, value);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// returns nanoseconds per call
+static double benchmark_encode(char *(*encode)(char *, uint32_t), int iterations) {
+	char base58[BASE58_MAX_LENGTH];
+	uint64_t start = nanoseconds();
+	int i;
+
+	for (i = 0; i < iterations; ++i) {
+		encode(base58, SCRAMBLE(i));
+
+		_sink += (uint8_t)base58[0];
+	}
+
+	return (double)(nanoseconds() - start) / iterations;
+}
+
+// decodes a rotating set of strings, so that the branch predictor cannot
+// learn a single string. returns nanoseconds per call
+static double benchmark_decode(int (*decode)(uint32_t *, const char *), int iterations) {
+	char base58[64][BASE58_MAX_LENGTH];
+	uint32_t value;
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < 64; ++i) {
+		base58_encode(base58[i], SCRAMBLE(i + 1));
+	}
+
+	start = nanoseconds();
+
+	for (i = 0; i < iterations; ++i) {
+		decode(&value, base58[i & 63]);
+
+		_sink += value;
+	}
+
+	return (double)(nanoseconds() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+	int iterations = DEFAULT_ITERATIONS;
+	int run;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+
+		if (iterations <= 0) {
+			fprintf(stderr, "usage: %s [<iterations>]\n", argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (check() < 0) {
+		return 1;
+	}
+
+	printf("cross-checked %d values, timing %d calls per run\n", CHECK_COUNT, iterations);
+
+	for (run = 1; run <= RUN_COUNT; ++run) {
+		printf("run %d: encode old %.1f ns, new %.1f ns\n", run,
+		       benchmark_encode(old_base58_encode, iterations),
+		       benchmark_encode(base58_encode, iterations));
+	}
+
+	for (run = 1; run <= RUN_COUNT; ++run) {
+		printf("run %d: decode old %.1f ns, new %.1f ns\n", run,
+		       benchmark_decode(old_base58_decode, iterations),
+		       benchmark_decode(base58_decode, iterations));
+	}
+
+	return 0;
+}
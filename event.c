@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2015 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2015, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * event.c: Event specific functions
  *
@@ -65,6 +65,10 @@ int event_init(void) {
 		return -1;
 	}
 
+	// pack event sources into chunks to keep them close to each other in
+	// memory. this cannot fail for an empty non-relocatable array
+	array_set_chunk_length(&_event_sources, 32);
+
 	if (event_init_platform() < 0) {
 		array_destroy(&_event_sources, NULL);
 
@@ -355,27 +359,34 @@ void event_remove_source(IOHandle handle, EventSourceType type) {
 	}
 }
 
-// remove event sources that got marked as removed and mark (re-)added event
-// sources as normal
-void event_cleanup_sources(void) {
-	int i;
-	EventSource *event_source;
+static bool event_cleanup_source(void *item, void *opaque) {
+	EventSource *event_source = item;
+	int *index = opaque;
 
-	// iterate backwards for simpler index handling and to be able to print
-	// the correct index
-	for (i = _event_sources.count - 1; i >= 0; --i) {
-		event_source = array_get(&_event_sources, i);
+	if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
+		log_event_debug("Removed %s event source (handle: %d, events: 0x%04X) at index %d",
+		                event_get_source_type_name(event_source->type, false),
+		                event_source->handle, event_source->events, *index);
 
-		if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
-			log_event_debug("Removed %s event source (handle: %d, events: 0x%04X) at index %d",
-			                event_get_source_type_name(event_source->type, false),
-			                event_source->handle, event_source->events, i);
+		++*index;
 
-			array_remove(&_event_sources, i, NULL);
-		} else {
-			event_source->state = EVENT_SOURCE_STATE_NORMAL;
-		}
+		return true;
 	}
+
+	event_source->state = EVENT_SOURCE_STATE_NORMAL;
+
+	++*index;
+
+	return false;
+}
+
+// remove event sources that got marked as removed and mark (re-)added event
+// sources as normal
+void event_cleanup_sources(void) {
+	int index = 0;
+
+	// remove all marked event sources in a single pass over the array
+	array_remove_if(&_event_sources, event_cleanup_source, &index, NULL);
 }
 
 void event_handle_source(EventSource *event_source, uint32_t received_events) {
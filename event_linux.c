@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2014, 2016 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2014, 2016, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * event_linux.c: epoll based event loop
  *
@@ -127,6 +127,10 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 		return -1;
 	}
 
+	// the number of event sources might temporarily be much higher than
+	// usual, don't keep the memory for all of them afterwards
+	array_set_auto_shrink(&received_events, true);
+
 	*running = true;
 
 	cleanup();
@@ -0,0 +1,567 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * hash_table.c: Open addressing hash table
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a HashTable object maps integer or string keys to items of a fixed size.
+ * the items are stored directly in the slots of the table, using open
+ * addressing with linear probing. string keys are copied into the table.
+ *
+ * like for relocatable items in an Array object you're not allowed to keep
+ * pointers to items while inserting or removing items, because this may move
+ * other items in memory.
+ *
+ * to avoid a latency spike when the table grows, the old slots are not
+ * rehashed all at once. instead the old slots are kept as previous slots and a
+ * few of them are migrated to the new slots on each insert and remove. lookups
+ * check both the previous and the current slots. migrated and removed previous
+ * slots are marked as deleted, so lookups in the previous slots don't stop
+ * early. the current slots never contain deleted slots, because items are
+ * removed from them by moving the following items of the same cluster back.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_table.h"
+
+#include "macros.h"
+
+#define MIN_CAPACITY 16
+#define MIGRATION_STEP 16
+
+typedef enum {
+	HASH_TABLE_SLOT_STATE_EMPTY = 0,
+	HASH_TABLE_SLOT_STATE_OCCUPIED,
+	HASH_TABLE_SLOT_STATE_DELETED
+} HashTableSlotState;
+
+typedef struct {
+	uint64_t hash;
+	union {
+		uint64_t integer;
+		char *string;
+	} key;
+	int state;
+} HashTableSlotHeader;
+
+typedef struct {
+	uint64_t hash;
+	uint64_t integer;
+	const char *string;
+} HashTableKey;
+
+#define SLOT_HEADER_SIZE ((int)((sizeof(HashTableSlotHeader) + 7) / 8 * 8))
+
+// SplitMix64 finalizer, spreads sequential integers over all bits
+static uint64_t hash_table_hash_integer(uint64_t key) {
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+
+	return key;
+}
+
+// 64-bit FNV-1a
+static uint64_t hash_table_hash_string(const char *key) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*key != '\0') {
+		hash ^= (uint8_t)*key++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static HashTableSlotHeader *hash_table_get_slot(HashTable *table, HashTableSlots *slots, int index) {
+	return (HashTableSlotHeader *)(slots->bytes + table->slot_size * index);
+}
+
+static void *hash_table_get_item(HashTableSlotHeader *header) {
+	return (uint8_t *)header + SLOT_HEADER_SIZE;
+}
+
+static bool hash_table_is_matching(HashTable *table, HashTableSlotHeader *header,
+                                   HashTableKey *key) {
+	if (header->hash != key->hash) {
+		return false;
+	}
+
+	if (table->key_type == HASH_TABLE_KEY_TYPE_INTEGER) {
+		return header->key.integer == key->integer;
+	} else {
+		return strcmp(header->key.string, key->string) == 0;
+	}
+}
+
+// returns the index of the slot for KEY or -1 if not found
+static int hash_table_find(HashTable *table, HashTableSlots *slots, HashTableKey *key) {
+	int mask = slots->capacity - 1;
+	int index;
+	int i;
+	HashTableSlotHeader *header;
+
+	if (slots->used == 0) {
+		return -1;
+	}
+
+	index = key->hash & mask;
+
+	for (i = 0; i < slots->capacity; ++i) {
+		header = hash_table_get_slot(table, slots, index);
+
+		if (header->state == HASH_TABLE_SLOT_STATE_EMPTY) {
+			return -1;
+		}
+
+		if (header->state == HASH_TABLE_SLOT_STATE_OCCUPIED &&
+		    hash_table_is_matching(table, header, key)) {
+			return index;
+		}
+
+		index = (index + 1) & mask;
+	}
+
+	return -1;
+}
+
+// returns the first empty slot for HASH in the current slots. the current
+// slots are never full, so there is always an empty slot
+static HashTableSlotHeader *hash_table_find_empty(HashTable *table, uint64_t hash) {
+	int mask = table->current.capacity - 1;
+	int index = hash & mask;
+	HashTableSlotHeader *header;
+
+	for (;;) {
+		header = hash_table_get_slot(table, &table->current, index);
+
+		if (header->state == HASH_TABLE_SLOT_STATE_EMPTY) {
+			return header;
+		}
+
+		index = (index + 1) & mask;
+	}
+}
+
+static void hash_table_release_slot(HashTable *table, HashTableSlotHeader *header,
+                                    ItemDestroyFunction destroy) {
+	if (destroy != NULL) {
+		destroy(hash_table_get_item(header));
+	}
+
+	if (table->key_type == HASH_TABLE_KEY_TYPE_STRING) {
+		free(header->key.string);
+	}
+}
+
+static void hash_table_release_slots(HashTable *table, HashTableSlots *slots,
+                                     ItemDestroyFunction destroy) {
+	int i;
+	HashTableSlotHeader *header;
+
+	for (i = 0; i < slots->capacity && slots->used > 0; ++i) {
+		header = hash_table_get_slot(table, slots, i);
+
+		if (header->state == HASH_TABLE_SLOT_STATE_OCCUPIED) {
+			hash_table_release_slot(table, header, destroy);
+
+			--slots->used;
+		}
+	}
+
+	free(slots->bytes);
+
+	slots->capacity = 0;
+	slots->used = 0;
+	slots->bytes = NULL;
+}
+
+// migrates up to COUNT previous slots to the current slots and frees the
+// previous slots once they are empty
+static void hash_table_migrate(HashTable *table, int count) {
+	HashTableSlotHeader *header;
+
+	if (table->previous.bytes == NULL) {
+		return;
+	}
+
+	while (count-- > 0 && table->previous.used > 0) {
+		header = hash_table_get_slot(table, &table->previous, table->migrated++);
+
+		if (header->state == HASH_TABLE_SLOT_STATE_OCCUPIED) {
+			memcpy(hash_table_find_empty(table, header->hash), header, table->slot_size);
+
+			header->state = HASH_TABLE_SLOT_STATE_DELETED;
+
+			--table->previous.used;
+			++table->current.used;
+		}
+	}
+
+	if (table->previous.used == 0) {
+		free(table->previous.bytes);
+
+		table->previous.capacity = 0;
+		table->previous.bytes = NULL;
+		table->migrated = 0;
+	}
+}
+
+// ensures that the current slots have room for one more item, keeping the load
+// factor at or below 3/4. if the current slots have to grow then they become
+// the previous slots, after finishing the migration of an older set of
+// previous slots, if any.
+//
+// returns -1 on error (sets errno) or 0 on success
+static int hash_table_grow(HashTable *table) {
+	int capacity = table->current.capacity * 2;
+	uint8_t *bytes;
+
+	if ((table->current.used + 1) * 4 <= table->current.capacity * 3) {
+		return 0;
+	}
+
+	bytes = calloc(capacity, table->slot_size);
+
+	if (bytes == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	// normally the previous slots are fully migrated long before this
+	// happens, because the current slots have twice their capacity
+	hash_table_migrate(table, INT32_MAX);
+
+	table->previous = table->current;
+	table->migrated = 0;
+
+	table->current.capacity = capacity;
+	table->current.used = 0;
+	table->current.bytes = bytes;
+
+	return 0;
+}
+
+// removes the item at INDEX from the current slots by moving following items
+// of the same cluster back, so no deleted slot is left behind
+static void hash_table_erase(HashTable *table, int index) {
+	int mask = table->current.capacity - 1;
+	int next = index;
+	int home;
+	HashTableSlotHeader *header;
+
+	for (;;) {
+		next = (next + 1) & mask;
+		header = hash_table_get_slot(table, &table->current, next);
+
+		if (header->state == HASH_TABLE_SLOT_STATE_EMPTY) {
+			break;
+		}
+
+		home = header->hash & mask;
+
+		// the item at NEXT cannot be moved to INDEX if its home slot is in
+		// the cyclic range (INDEX, NEXT]
+		if (index <= next ? (index < home && home <= next) : (index < home || home <= next)) {
+			continue;
+		}
+
+		memcpy(hash_table_get_slot(table, &table->current, index), header, table->slot_size);
+
+		index = next;
+	}
+
+	memset(hash_table_get_slot(table, &table->current, index), 0, table->slot_size);
+
+	--table->current.used;
+}
+
+static void *hash_table_insert(HashTable *table, HashTableKey *key) {
+	char *string = NULL;
+	HashTableSlotHeader *header;
+
+	hash_table_migrate(table, MIGRATION_STEP);
+
+	if (hash_table_find(table, &table->previous, key) >= 0 ||
+	    hash_table_find(table, &table->current, key) >= 0) {
+		errno = EEXIST;
+
+		return NULL;
+	}
+
+	if (hash_table_grow(table) < 0) {
+		return NULL;
+	}
+
+	if (table->key_type == HASH_TABLE_KEY_TYPE_STRING) {
+		string = strdup(key->string);
+
+		if (string == NULL) {
+			errno = ENOMEM;
+
+			return NULL;
+		}
+	}
+
+	header = hash_table_find_empty(table, key->hash);
+
+	header->hash = key->hash;
+	header->state = HASH_TABLE_SLOT_STATE_OCCUPIED;
+
+	if (table->key_type == HASH_TABLE_KEY_TYPE_INTEGER) {
+		header->key.integer = key->integer;
+	} else {
+		header->key.string = string;
+	}
+
+	memset(hash_table_get_item(header), 0, table->size);
+
+	++table->current.used;
+	++table->count;
+
+	return hash_table_get_item(header);
+}
+
+static void *hash_table_get(HashTable *table, HashTableKey *key) {
+	int index = hash_table_find(table, &table->previous, key);
+
+	if (index >= 0) {
+		return hash_table_get_item(hash_table_get_slot(table, &table->previous, index));
+	}
+
+	index = hash_table_find(table, &table->current, key);
+
+	if (index >= 0) {
+		return hash_table_get_item(hash_table_get_slot(table, &table->current, index));
+	}
+
+	return NULL;
+}
+
+static int hash_table_remove(HashTable *table, HashTableKey *key, ItemDestroyFunction destroy) {
+	int index;
+	HashTableSlotHeader *header;
+
+	hash_table_migrate(table, MIGRATION_STEP);
+
+	index = hash_table_find(table, &table->previous, key);
+
+	if (index >= 0) {
+		header = hash_table_get_slot(table, &table->previous, index);
+
+		hash_table_release_slot(table, header, destroy);
+
+		header->state = HASH_TABLE_SLOT_STATE_DELETED;
+
+		--table->previous.used;
+		--table->count;
+
+		// frees the previous slots if this was the last item in them
+		hash_table_migrate(table, 0);
+
+		return 0;
+	}
+
+	index = hash_table_find(table, &table->current, key);
+
+	if (index >= 0) {
+		hash_table_release_slot(table, hash_table_get_slot(table, &table->current, index), destroy);
+		hash_table_erase(table, index);
+
+		--table->count;
+
+		return 0;
+	}
+
+	errno = ENOENT;
+
+	return -1;
+}
+
+static void hash_table_make_integer_key(HashTableKey *key, uint64_t integer) {
+	key->hash = hash_table_hash_integer(integer);
+	key->integer = integer;
+	key->string = NULL;
+}
+
+static void hash_table_make_string_key(HashTableKey *key, const char *string) {
+	key->hash = hash_table_hash_string(string);
+	key->integer = 0;
+	key->string = string;
+}
+
+// creates an empty HashTable object with room for at least the number of
+// items specified by RESERVE (>= 0) before it has to grow. each item is SIZE
+// (> 0) bytes in size. the keys are of the given KEY_TYPE.
+//
+// returns -1 on error (sets errno) or 0 on success
+int hash_table_create(HashTable *table, int reserve, int size, HashTableKeyType key_type) {
+	int capacity = MIN_CAPACITY;
+
+	while (reserve * 4 > capacity * 3) {
+		capacity *= 2;
+	}
+
+	table->size = size;
+	table->slot_size = (SLOT_HEADER_SIZE + size + 7) / 8 * 8;
+	table->key_type = key_type;
+	table->count = 0;
+	table->current.capacity = capacity;
+	table->current.used = 0;
+	table->current.bytes = calloc(capacity, table->slot_size);
+	table->previous.capacity = 0;
+	table->previous.used = 0;
+	table->previous.bytes = NULL;
+	table->migrated = 0;
+
+	if (table->current.bytes == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// destroys a HashTable object and frees the underlying memory. if an item
+// destroy function DESTROY is given then it is called for each item in the
+// table (with a pointer to the item as the only parameter) before the memory
+// is freed.
+void hash_table_destroy(HashTable *table, ItemDestroyFunction destroy) {
+	hash_table_release_slots(table, &table->previous, destroy);
+	hash_table_release_slots(table, &table->current, destroy);
+}
+
+// inserts a new item for the integer KEY into a HashTable object. the memory
+// of this item is initialized to zero.
+//
+// returns NULL on error (sets errno) or a pointer to the new item on success.
+// if an item for KEY already exists then errno is set to EEXIST.
+void *hash_table_insert_integer(HashTable *table, uint64_t key) {
+	HashTableKey hash_table_key;
+
+	hash_table_make_integer_key(&hash_table_key, key);
+
+	return hash_table_insert(table, &hash_table_key);
+}
+
+// inserts a new item for the string KEY into a HashTable object. the key is
+// copied and the memory of the item is initialized to zero.
+//
+// returns NULL on error (sets errno) or a pointer to the new item on success.
+// if an item for KEY already exists then errno is set to EEXIST.
+void *hash_table_insert_string(HashTable *table, const char *key) {
+	HashTableKey hash_table_key;
+
+	hash_table_make_string_key(&hash_table_key, key);
+
+	return hash_table_insert(table, &hash_table_key);
+}
+
+// returns a pointer to the item for the integer KEY or NULL if not found
+void *hash_table_get_integer(HashTable *table, uint64_t key) {
+	HashTableKey hash_table_key;
+
+	hash_table_make_integer_key(&hash_table_key, key);
+
+	return hash_table_get(table, &hash_table_key);
+}
+
+// returns a pointer to the item for the string KEY or NULL if not found
+void *hash_table_get_string(HashTable *table, const char *key) {
+	HashTableKey hash_table_key;
+
+	hash_table_make_string_key(&hash_table_key, key);
+
+	return hash_table_get(table, &hash_table_key);
+}
+
+// removes the item for the integer KEY from a HashTable object. if an item
+// destroy function DESTROY is given then it is called (with a pointer to the
+// item as the only parameter) before it is removed.
+//
+// returns -1 on error (sets errno to ENOENT if not found) or 0 on success
+int hash_table_remove_integer(HashTable *table, uint64_t key, ItemDestroyFunction destroy) {
+	HashTableKey hash_table_key;
+
+	hash_table_make_integer_key(&hash_table_key, key);
+
+	return hash_table_remove(table, &hash_table_key, destroy);
+}
+
+// removes the item for the string KEY from a HashTable object. if an item
+// destroy function DESTROY is given then it is called (with a pointer to the
+// item as the only parameter) before it is removed.
+//
+// returns -1 on error (sets errno to ENOENT if not found) or 0 on success
+int hash_table_remove_string(HashTable *table, const char *key, ItemDestroyFunction destroy) {
+	HashTableKey hash_table_key;
+
+	hash_table_make_string_key(&hash_table_key, key);
+
+	return hash_table_remove(table, &hash_table_key, destroy);
+}
+
+// returns the integer key of an ITEM stored in a HashTable object
+uint64_t hash_table_get_integer_key(HashTable *table, void *item) {
+	(void)table;
+
+	return ((HashTableSlotHeader *)((uint8_t *)item - SLOT_HEADER_SIZE))->key.integer;
+}
+
+// returns the string key of an ITEM stored in a HashTable object
+const char *hash_table_get_string_key(HashTable *table, void *item) {
+	(void)table;
+
+	return ((HashTableSlotHeader *)((uint8_t *)item - SLOT_HEADER_SIZE))->key.string;
+}
+
+// prepares an ITERATOR to iterate over all items of a HashTable object
+void hash_table_iterator_init(HashTableIterator *iterator) {
+	iterator->phase = 0;
+	iterator->index = 0;
+}
+
+// returns a pointer to the next item of a HashTable object or NULL if all
+// items have been visited. the items are visited in no particular order. the
+// table must not be changed while iterating over it.
+void *hash_table_iterate(HashTable *table, HashTableIterator *iterator) {
+	HashTableSlots *slots;
+	HashTableSlotHeader *header;
+
+	for (; iterator->phase < 2; ++iterator->phase, iterator->index = 0) {
+		slots = iterator->phase == 0 ? &table->previous : &table->current;
+
+		while (iterator->index < slots->capacity) {
+			header = hash_table_get_slot(table, slots, iterator->index++);
+
+			if (header->state == HASH_TABLE_SLOT_STATE_OCCUPIED) {
+				return hash_table_get_item(header);
+			}
+		}
+	}
+
+	return NULL;
+}
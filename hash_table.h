@@ -0,0 +1,74 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * hash_table.h: Open addressing hash table
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_HASH_TABLE_H
+#define DAEMONLIB_HASH_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+typedef enum {
+	HASH_TABLE_KEY_TYPE_INTEGER = 0,
+	HASH_TABLE_KEY_TYPE_STRING
+} HashTableKeyType;
+
+typedef struct {
+	int capacity; // number of slots, power of two
+	int used; // number of occupied slots
+	uint8_t *bytes;
+} HashTableSlots;
+
+typedef struct {
+	int size; // size of a single item in bytes
+	int slot_size; // size of a slot including its header in bytes
+	HashTableKeyType key_type;
+	int count; // number of stored items
+	HashTableSlots current;
+	HashTableSlots previous; // slots that are still being migrated
+	int migrated; // number of already migrated previous slots
+} HashTable;
+
+typedef struct {
+	int phase; // 0 for previous slots, 1 for current slots
+	int index;
+} HashTableIterator;
+
+int hash_table_create(HashTable *table, int reserve, int size, HashTableKeyType key_type);
+void hash_table_destroy(HashTable *table, ItemDestroyFunction destroy);
+
+void *hash_table_insert_integer(HashTable *table, uint64_t key);
+void *hash_table_insert_string(HashTable *table, const char *key);
+
+void *hash_table_get_integer(HashTable *table, uint64_t key);
+void *hash_table_get_string(HashTable *table, const char *key);
+
+int hash_table_remove_integer(HashTable *table, uint64_t key, ItemDestroyFunction destroy);
+int hash_table_remove_string(HashTable *table, const char *key, ItemDestroyFunction destroy);
+
+uint64_t hash_table_get_integer_key(HashTable *table, void *item);
+const char *hash_table_get_string_key(HashTable *table, void *item);
+
+void hash_table_iterator_init(HashTableIterator *iterator);
+void *hash_table_iterate(HashTable *table, HashTableIterator *iterator);
+
+#endif // DAEMONLIB_HASH_TABLE_H
@@ -0,0 +1,184 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * heap.c: Intrusive min-heap
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a Heap object orders HeapNode objects by a less function, so that the
+ * smallest node can be found in O(1) and removed in amortized O(log n). like a
+ * Node the HeapNode is embedded into the struct that should be stored in the
+ * heap and containerof is used to get from the HeapNode to the containing
+ * struct. this avoids extra allocations, for example for deadlines:
+ *
+ *   typedef struct {
+ *       uint64_t deadline;
+ *       HeapNode heap_node;
+ *   } Timeout;
+ *
+ *   static bool timeout_less(HeapNode *a, HeapNode *b) {
+ *       return containerof(a, Timeout, heap_node)->deadline <
+ *              containerof(b, Timeout, heap_node)->deadline;
+ *   }
+ *
+ * the heap is implemented as a pairing heap. inserting a node and merging two
+ * heaps is O(1), arbitrary nodes can be removed without searching for them.
+ */
+
+#include <stddef.h>
+
+#include "heap.h"
+
+static void heap_node_reset(HeapNode *node) {
+	node->child = NULL;
+	node->next = NULL;
+	node->prev = NULL;
+}
+
+// merges two heaps given by their root nodes A and B (both non-NULL) into one
+// and returns the root of the merged heap
+static HeapNode *heap_meld(Heap *heap, HeapNode *a, HeapNode *b) {
+	HeapNode *tmp;
+
+	if (heap->less(b, a)) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	b->prev = a;
+	b->next = a->child;
+
+	if (a->child != NULL) {
+		a->child->prev = b;
+	}
+
+	a->child = b;
+
+	return a;
+}
+
+// merges the sibling list starting at FIRST into one heap using the two-pass
+// pairing scheme and returns its root, or NULL if FIRST is NULL
+static HeapNode *heap_merge_pairs(Heap *heap, HeapNode *first) {
+	HeapNode *pairs = NULL; // merged pairs in reverse order, linked via next
+	HeapNode *a;
+	HeapNode *b;
+	HeapNode *rest;
+
+	// first pass: merge pairs from left to right
+	while (first != NULL) {
+		a = first;
+		b = a->next;
+		rest = b != NULL ? b->next : NULL;
+
+		a->next = NULL;
+		a->prev = NULL;
+
+		if (b != NULL) {
+			b->next = NULL;
+			b->prev = NULL;
+
+			a = heap_meld(heap, a, b);
+		}
+
+		a->next = pairs;
+		pairs = a;
+		first = rest;
+	}
+
+	// second pass: merge the pairs from right to left
+	first = NULL;
+
+	while (pairs != NULL) {
+		rest = pairs->next;
+		pairs->next = NULL;
+		first = first != NULL ? heap_meld(heap, first, pairs) : pairs;
+		pairs = rest;
+	}
+
+	return first;
+}
+
+// creates an empty Heap object that orders its nodes by the LESS function
+void heap_create(Heap *heap, HeapLessFunction less) {
+	heap->root = NULL;
+	heap->less = less;
+	heap->count = 0;
+}
+
+// NOTE: assumes that NODE is not part of another heap already
+void heap_insert(Heap *heap, HeapNode *node) {
+	heap_node_reset(node);
+
+	heap->root = heap->root != NULL ? heap_meld(heap, heap->root, node) : node;
+
+	++heap->count;
+}
+
+// NOTE: assumes that NODE is part of HEAP
+void heap_remove(Heap *heap, HeapNode *node) {
+	HeapNode *merged;
+
+	if (node == heap->root) {
+		heap->root = heap_merge_pairs(heap, node->child);
+	} else {
+		// unlink the node from its parent or its previous sibling
+		if (node->prev->child == node) {
+			node->prev->child = node->next;
+		} else {
+			node->prev->next = node->next;
+		}
+
+		if (node->next != NULL) {
+			node->next->prev = node->prev;
+		}
+
+		merged = heap_merge_pairs(heap, node->child);
+
+		if (merged != NULL) {
+			heap->root = heap_meld(heap, heap->root, merged);
+		}
+	}
+
+	heap_node_reset(node);
+
+	--heap->count;
+}
+
+// restores the heap order after the key of NODE (part of HEAP) was changed
+void heap_update(Heap *heap, HeapNode *node) {
+	heap_remove(heap, node);
+	heap_insert(heap, node);
+}
+
+// returns the smallest node or NULL if the heap is empty
+HeapNode *heap_peek(Heap *heap) {
+	return heap->root;
+}
+
+// removes and returns the smallest node or returns NULL if the heap is empty
+HeapNode *heap_pop(Heap *heap) {
+	HeapNode *node = heap->root;
+
+	if (node != NULL) {
+		heap_remove(heap, node);
+	}
+
+	return node;
+}
@@ -0,0 +1,53 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * heap.h: Intrusive min-heap
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_HEAP_H
+#define DAEMONLIB_HEAP_H
+
+#include <stdbool.h>
+
+typedef struct _HeapNode HeapNode;
+
+struct _HeapNode {
+	HeapNode *child; // first child
+	HeapNode *next; // next sibling
+	HeapNode *prev; // previous sibling, or parent for the first child
+};
+
+// returns true if A has to be popped before B
+typedef bool (*HeapLessFunction)(HeapNode *a, HeapNode *b);
+
+typedef struct {
+	HeapNode *root;
+	HeapLessFunction less;
+	int count;
+} Heap;
+
+void heap_create(Heap *heap, HeapLessFunction less);
+
+void heap_insert(Heap *heap, HeapNode *node);
+void heap_remove(Heap *heap, HeapNode *node);
+void heap_update(Heap *heap, HeapNode *node);
+
+HeapNode *heap_peek(Heap *heap);
+HeapNode *heap_pop(Heap *heap);
+
+#endif // DAEMONLIB_HEAP_H
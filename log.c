@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012, 2014, 2016-2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012, 2014, 2016-2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * log.c: Logging specific functions
@@ -37,6 +37,15 @@ typedef struct {
 	uint32_t groups;
 } LogDebugFilter;
 
+// a log message whose text is formatted on first use. this way the text is
+// formatted at most once, even if the message is written to multiple outputs
+typedef struct {
+	const char *format;
+	va_list *arguments;
+	bool formatted;
+	char text[1024];
+} LogRecord;
+
 static Mutex _mutex; // protects writing to _output
 static LogLevel _level = LOG_LEVEL_INFO;
 static IO *_output = NULL;
@@ -56,7 +65,7 @@ extern bool log_is_included_platform(LogLevel level, LogSource *source,
 extern void log_write_platform(struct timeval *timestamp, LogLevel level,
                                LogSource *source, LogDebugGroup debug_group,
                                const char *function, int line,
-                               const char *format, va_list arguments);
+                               const char *message);
 
 static int stderr_write(IO *io, const void *buffer, int length) {
 	int rc;
@@ -170,18 +179,85 @@ static void log_set_debug_filter(const char *filter) {
 	_debug_filter_count = i;
 }
 
+static const char *log_record_get_text(LogRecord *record) {
+	if (!record->formatted) {
+		vsnprintf(record->text, sizeof(record->text), record->format, *record->arguments);
+
+		record->formatted = true;
+	}
+
+	return record->text;
+}
+
+static int log_format_prefix(char *buffer, int length, struct timeval *timestamp,
+                             LogLevel level, LogSource *source, LogDebugGroup debug_group,
+                             const char *function, int line) {
+	time_t unix_seconds;
+	struct tm localized_timestamp;
+	char formatted_timestamp[64] = "<unknown>";
+	char level_char;
+	char *debug_group_name = "";
+	char line_str[16] = "<unknown>";
+	int offset;
+
+	// copy value to time_t variable because timeval.tv_sec and time_t
+	// can have different sizes between different compilers and compiler
+	// version and platforms. for example with WDK 7 both are 4 byte in
+	// size, but with MSVC 2010 time_t is 8 byte in size but timeval.tv_sec
+	// is still 4 byte in size.
+	unix_seconds = timestamp->tv_sec;
+
+	// format time
+	if (localtime_r(&unix_seconds, &localized_timestamp) != NULL) {
+		strftime(formatted_timestamp, sizeof(formatted_timestamp),
+		         "%Y-%m-%d %H:%M:%S", &localized_timestamp);
+	}
+
+	// format level
+	switch (level) {
+	case LOG_LEVEL_ERROR: level_char = 'E'; break;
+	case LOG_LEVEL_WARN:  level_char = 'W'; break;
+	case LOG_LEVEL_INFO:  level_char = 'I'; break;
+	case LOG_LEVEL_DEBUG: level_char = 'D'; break;
+	default:              level_char = 'U'; break;
+	}
+
+	// format debug group
+	switch (debug_group) {
+	case LOG_DEBUG_GROUP_EVENT:  debug_group_name = "event|";  break;
+	case LOG_DEBUG_GROUP_PACKET: debug_group_name = "packet|"; break;
+	case LOG_DEBUG_GROUP_OBJECT: debug_group_name = "object|"; break;
+	case LOG_DEBUG_GROUP_LIBUSB:                               break;
+	default:                                                   break;
+	}
+
+	// format line
+	snprintf(line_str, sizeof(line_str), "%d", line);
+
+	// format prefix
+	offset = snprintf(buffer, length, "%s.%06d <%c> <%s%s:%s> ",
+	                  formatted_timestamp, (int)timestamp->tv_usec, level_char,
+	                  debug_group_name, source->name, line >= 0 ? line_str : function);
+
+	return offset < 0 ? 0 : MIN(offset, length - 1);
+}
+
 // NOTE: assumes that _mutex is locked
 static void log_write(struct timeval *timestamp, LogLevel level, LogSource *source,
                       LogDebugGroup debug_group, const char *function, int line,
-                      const char *format, va_list arguments) {
+                      LogRecord *record) {
 	char buffer[1024] = "<unknown>";
+	int offset;
 
 	if (_output == NULL) {
 		return;
 	}
 
-	log_format(buffer, sizeof(buffer), timestamp, level, source, debug_group,
-	           function, line, format, arguments);
+	offset = log_format_prefix(buffer, sizeof(buffer), timestamp, level, source,
+	                           debug_group, function, line);
+
+	snprintf(buffer + offset, sizeof(buffer) - offset, "%s" LOG_NEWLINE,
+	         log_record_get_text(record));
 
 	log_apply_color_platform(level, true);
 	io_write(_output, buffer, strlen(buffer));
@@ -313,6 +389,9 @@ void log_message(LogLevel level, LogSource *source, LogDebugGroup debug_group,
                  const char *function, int line, const char *format, ...) {
 	struct timeval timestamp;
 	va_list arguments;
+	bool primary;
+	bool secondary;
+	LogRecord record;
 
 	if (level == LOG_LEVEL_DUMMY) {
 		return; // should never be reachable
@@ -325,78 +404,46 @@ void log_message(LogLevel level, LogSource *source, LogDebugGroup debug_group,
 		timestamp.tv_usec = 0;
 	}
 
+	log_lock();
+
+	primary = (level <= _level || _debug_override) &&
+	          (level != LOG_LEVEL_DEBUG ||
+	           (source->included_debug_groups & debug_group) != 0);
+	secondary = log_is_included_platform(level, source, debug_group);
+
+	// the message text is only formatted if an output actually writes it
+	if (!primary && !secondary) {
+		log_unlock();
+
+		return;
+	}
+
 	// call log handlers
 	va_start(arguments, format);
-	log_lock();
 
-	if ((level <= _level || _debug_override) &&
-	    (level != LOG_LEVEL_DEBUG ||
-	     (source->included_debug_groups & debug_group) != 0)) {
-		log_write(&timestamp, level, source, debug_group, function, line,
-		          format, arguments);
+	record.format = format;
+	record.arguments = &arguments;
+	record.formatted = false;
+
+	if (primary) {
+		log_write(&timestamp, level, source, debug_group, function, line, &record);
 	}
 
-	if (log_is_included_platform(level, source, debug_group)) {
+	if (secondary) {
 		log_write_platform(&timestamp, level, source, debug_group, function,
-		                   line, format, arguments);
+		                   line, log_record_get_text(&record));
 	}
 
-	log_unlock();
 	va_end(arguments);
+	log_unlock();
 }
 
 void log_format(char *buffer, int length, struct timeval *timestamp,
                 LogLevel level, LogSource *source, LogDebugGroup debug_group,
                 const char *function, int line, const char *format,
                 va_list arguments) {
-	time_t unix_seconds;
-	struct tm localized_timestamp;
-	char formatted_timestamp[64] = "<unknown>";
-	char level_char;
-	char *debug_group_name = "";
-	char line_str[16] = "<unknown>";
-	int offset;
-
-	// copy value to time_t variable because timeval.tv_sec and time_t
-	// can have different sizes between different compilers and compiler
-	// version and platforms. for example with WDK 7 both are 4 byte in
-	// size, but with MSVC 2010 time_t is 8 byte in size but timeval.tv_sec
-	// is still 4 byte in size.
-	unix_seconds = timestamp->tv_sec;
-
-	// format time
-	if (localtime_r(&unix_seconds, &localized_timestamp) != NULL) {
-		strftime(formatted_timestamp, sizeof(formatted_timestamp),
-		         "%Y-%m-%d %H:%M:%S", &localized_timestamp);
-	}
-
-	// format level
-	switch (level) {
-	case LOG_LEVEL_ERROR: level_char = 'E'; break;
-	case LOG_LEVEL_WARN:  level_char = 'W'; break;
-	case LOG_LEVEL_INFO:  level_char = 'I'; break;
-	case LOG_LEVEL_DEBUG: level_char = 'D'; break;
-	default:              level_char = 'U'; break;
-	}
-
-	// format debug group
-	switch (debug_group) {
-	case LOG_DEBUG_GROUP_EVENT:  debug_group_name = "event|";  break;
-	case LOG_DEBUG_GROUP_PACKET: debug_group_name = "packet|"; break;
-	case LOG_DEBUG_GROUP_OBJECT: debug_group_name = "object|"; break;
-	case LOG_DEBUG_GROUP_LIBUSB:                               break;
-	default:                                                   break;
-	}
-
-	// format line
-	snprintf(line_str, sizeof(line_str), "%d", line);
-
-	// format prefix
-	snprintf(buffer, length, "%s.%06d <%c> <%s%s:%s> ",
-	         formatted_timestamp, (int)timestamp->tv_usec, level_char,
-	         debug_group_name, source->name, line >= 0 ? line_str : function);
-
-	offset = strlen(buffer); // FIXME: avoid strlen call
+	int offset = log_format_prefix(buffer, length, timestamp, level, source,
+	                               debug_group, function, line);
 
 	// format message
 	vsnprintf(buffer + offset, MAX(length - offset, 0), format, arguments);
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014, 2016 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2016, 2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * log.h: Logging specific functions
@@ -77,6 +77,9 @@ typedef struct {
 	#define LOG_NEWLINE "\n"
 #endif
 
+// the arguments of a log message are only evaluated if the message is included
+// in any output. expensive arguments such as packet signatures can be passed
+// directly, they are not formatted for messages that are filtered out
 #ifdef DAEMONLIB_WITH_LOGGING
 	#ifdef _MSC_VER
 		#define log_message_checked(level, debug_group, ...) \
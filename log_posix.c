@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012, 2014, 2016-2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012, 2014, 2016-2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * log_posix.c: POSIX specific log handling
  *
@@ -108,13 +108,12 @@ bool log_is_included_platform(LogLevel level, LogSource *source,
 void log_write_platform(struct timeval *timestamp, LogLevel level,
                         LogSource *source, LogDebugGroup debug_group,
                         const char *function, int line,
-                        const char *format, va_list arguments) {
+                        const char *message) {
 	(void)timestamp;
 	(void)level;
 	(void)source;
 	(void)debug_group;
 	(void)function;
 	(void)line;
-	(void)format;
-	(void)arguments;
+	(void)message;
 }
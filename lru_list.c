@@ -0,0 +1,96 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * lru_list.c: Intrusive least-recently-used list
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * an LRUList object keeps Node objects in the order they were last used. like
+ * for a plain Node list the Node is embedded into the struct that should be
+ * stored in the list and containerof is used to get from the Node to the
+ * containing struct. inserting, touching and removing a node is O(1).
+ *
+ * the nodes form a circular list that starts at the oldest node, the newest
+ * node is the one before the oldest node. in contrast to a list with a
+ * sentinel node no node is part of the LRUList object itself, so the LRUList
+ * object can be moved in memory.
+ */
+
+#include <stddef.h>
+
+#include "lru_list.h"
+
+// creates an empty LRUList object
+void lru_list_create(LRUList *list) {
+	list->oldest = NULL;
+	list->count = 0;
+}
+
+// inserts NODE as the most recently used node
+// NOTE: assumes that NODE is not part of another linked list already
+void lru_list_insert(LRUList *list, Node *node) {
+	if (list->oldest == NULL) {
+		node_reset(node);
+
+		list->oldest = node;
+	} else {
+		node_insert_before(list->oldest, node);
+	}
+
+	++list->count;
+}
+
+// NOTE: assumes that NODE is part of LIST
+void lru_list_remove(LRUList *list, Node *node) {
+	if (node == list->oldest) {
+		list->oldest = node->next != node ? node->next : NULL;
+	}
+
+	node_remove(node);
+
+	--list->count;
+}
+
+// marks NODE (part of LIST) as the most recently used node
+void lru_list_touch(LRUList *list, Node *node) {
+	if (node == list->oldest) {
+		// the list is circular, the oldest node becomes the newest node by
+		// just advancing the start of the list
+		list->oldest = node->next;
+	} else if (node->next != list->oldest) { // not already the newest node
+		node_remove(node);
+		node_insert_before(list->oldest, node);
+	}
+}
+
+// returns the least recently used node or NULL if the list is empty
+Node *lru_list_peek_oldest(LRUList *list) {
+	return list->oldest;
+}
+
+// removes and returns the least recently used node or returns NULL if the list
+// is empty
+Node *lru_list_pop_oldest(LRUList *list) {
+	Node *node = list->oldest;
+
+	if (node != NULL) {
+		lru_list_remove(list, node);
+	}
+
+	return node;
+}
@@ -0,0 +1,41 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * lru_list.h: Intrusive least-recently-used list
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_LRU_LIST_H
+#define DAEMONLIB_LRU_LIST_H
+
+#include "node.h"
+
+typedef struct {
+	Node *oldest; // least recently used node, NULL if empty
+	int count;
+} LRUList;
+
+void lru_list_create(LRUList *list);
+
+void lru_list_insert(LRUList *list, Node *node);
+void lru_list_remove(LRUList *list, Node *node);
+void lru_list_touch(LRUList *list, Node *node);
+
+Node *lru_list_peek_oldest(LRUList *list);
+Node *lru_list_pop_oldest(LRUList *list);
+
+#endif // DAEMONLIB_LRU_LIST_H
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014, 2016 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2016, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * macros.h: Preprocessor macros
  *
@@ -70,6 +70,31 @@
 // with unsigned int SIZE - 1 would overflow to a big value if size is 0.
 #define GROW_ALLOCATION(size) ((((int)(size) - 1) / 16 + 1) * 16)
 
+// hint the compiler about the likely outcome of a condition, so that it can
+// lay out the expected path without a taken branch
+#if defined __GNUC__ || defined __clang__
+	#define PREDICT_TRUE(condition) __builtin_expect(!!(condition), 1)
+	#define PREDICT_FALSE(condition) __builtin_expect(!!(condition), 0)
+#else
+	#define PREDICT_TRUE(condition) (condition)
+	#define PREDICT_FALSE(condition) (condition)
+#endif
+
+// storage class for small functions defined in headers
+#ifdef _MSC_VER
+	#define STATIC_INLINE static __inline
+#else
+	#define STATIC_INLINE static inline
+#endif
+
+// storage class for thread-local variables. not defined if the compiler has
+// no support for it, code using it has to provide a fallback for this case
+#if defined __GNUC__ || defined __clang__
+	#define THREAD_LOCAL __thread
+#elif defined _MSC_VER
+	#define THREAD_LOCAL __declspec(thread)
+#endif
+
 // this is intentinally called containerof instead of container_of to avoid
 // conflicts with potential other definitions of the container_of macro
 #ifdef __GNUC__
@@ -0,0 +1,142 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * mpsc_queue.c: Lock-free multi-producer single-consumer queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * an MPSCQueue object stores items in a single linked list and allows any
+ * number of threads (the producers) to add items to its tail while exactly
+ * one thread (the consumer) removes items from its head, without locks or
+ * system calls. a producer only needs a single atomic exchange to add an item.
+ *
+ * the list always contains one node that was already consumed (initially the
+ * stub node embedded in the MPSCQueue object). the item at the head of the
+ * queue is stored in the node following it. because producers hold pointers
+ * to the stub node an MPSCQueue object must not be moved in memory.
+ *
+ * there is a short window in which a producer has added its node to the tail
+ * but has not linked it to the previous node yet. during this window the
+ * consumer sees the queue as empty, even if older items from other producers
+ * follow the new node. the consumer will see them as soon as the producer
+ * completes its push.
+ *
+ * the queue does not notify the consumer about new items. the consumer has to
+ * poll the queue or the producer has to notify it by other means.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpsc_queue.h"
+
+#include "atomic.h"
+
+// returns a pointer to the item stored at the given MPSCQueueNode
+static void *mpsc_queue_node_get_item(MPSCQueueNode *node) {
+	return (uint8_t *)node + sizeof(MPSCQueueNode);
+}
+
+// creates an empty MPSCQueue object. each item is SIZE (> 0) bytes in size.
+//
+// returns -1 on error (sets errno) or 0 on success
+int mpsc_queue_create(MPSCQueue *queue, int size) {
+	queue->size = size;
+	queue->stub.next = NULL;
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+
+	return 0;
+}
+
+// destroys an MPSCQueue object and frees the underlying single linked list. if
+// an item destroy function DESTROY is given then it is called for each item in
+// the queue (with a pointer to the item as the only parameter) before the
+// memory is freed. no producer can use the queue anymore at this point.
+void mpsc_queue_destroy(MPSCQueue *queue, ItemDestroyFunction destroy) {
+	while (mpsc_queue_peek(queue) != NULL) {
+		mpsc_queue_pop(queue, destroy);
+	}
+
+	if (queue->head != &queue->stub) {
+		free(queue->head);
+	}
+}
+
+// copies ITEM to the tail of an MPSCQueue object. can be called by any thread.
+//
+// returns -1 on error (sets errno) or 0 on success
+int mpsc_queue_push(MPSCQueue *queue, const void *item) {
+	MPSCQueueNode *node = malloc(sizeof(MPSCQueueNode) + queue->size);
+	MPSCQueueNode *previous;
+
+	if (node == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	node->next = NULL;
+
+	memcpy(mpsc_queue_node_get_item(node), item, queue->size);
+
+	previous = atomic_exchange(&queue->tail, node);
+
+	// make the node and its item visible to the consumer
+	atomic_store_release(&previous->next, node);
+
+	return 0;
+}
+
+// removes the item from the head of an MPSCQueue object. if an item destroy
+// function DESTROY is given then it is called (with a pointer to the item as
+// the only parameter) before it is removed. must only be called by the
+// consumer.
+void mpsc_queue_pop(MPSCQueue *queue, ItemDestroyFunction destroy) {
+	MPSCQueueNode *head = queue->head;
+	MPSCQueueNode *next = atomic_load_acquire(&head->next);
+
+	if (next == NULL) {
+		return;
+	}
+
+	if (destroy != NULL) {
+		destroy(mpsc_queue_node_get_item(next));
+	}
+
+	// the node of the removed item becomes the consumed node at the head
+	queue->head = next;
+
+	if (head != &queue->stub) {
+		free(head);
+	}
+}
+
+// returns a pointer to the item at the head of an MPSCQueue object or NULL if
+// the queue is empty. the item stays valid until it is removed by the consumer.
+// must only be called by the consumer.
+void *mpsc_queue_peek(MPSCQueue *queue) {
+	MPSCQueueNode *next = atomic_load_acquire(&queue->head->next);
+
+	if (next == NULL) {
+		return NULL;
+	}
+
+	return mpsc_queue_node_get_item(next);
+}
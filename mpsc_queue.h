@@ -0,0 +1,49 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * mpsc_queue.h: Lock-free multi-producer single-consumer queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_MPSC_QUEUE_H
+#define DAEMONLIB_MPSC_QUEUE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+typedef struct _MPSCQueueNode MPSCQueueNode;
+
+struct _MPSCQueueNode {
+	MPSCQueueNode *next;
+};
+
+typedef struct {
+	int size; // size of a single item in bytes
+	MPSCQueueNode *head; // only used by the consumer
+	MPSCQueueNode *tail; // shared between the producers
+	MPSCQueueNode stub;
+} MPSCQueue;
+
+int mpsc_queue_create(MPSCQueue *queue, int size);
+void mpsc_queue_destroy(MPSCQueue *queue, ItemDestroyFunction destroy);
+
+int mpsc_queue_push(MPSCQueue *queue, const void *item);
+void mpsc_queue_pop(MPSCQueue *queue, ItemDestroyFunction destroy);
+void *mpsc_queue_peek(MPSCQueue *queue);
+
+#endif // DAEMONLIB_MPSC_QUEUE_H
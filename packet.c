@@ -25,48 +25,131 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+#ifndef _MSC_VER
+	#include <sys/time.h>
+#endif
 
 #include "packet.h"
 
+#include "atomic.h"
 #include "base58.h"
+#include "config.h"
 #include "log.h"
 #include "macros.h"
+#include "threads.h"
 #include "utils.h"
 
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-#endif
-
 STATIC_ASSERT(sizeof(PacketHeader) == 8, "PacketHeader has invalid size");
 STATIC_ASSERT(sizeof(Packet) == 80, "Packet has invalid size");
-STATIC_ASSERT(sizeof(EnumerateCallback) == 34, "EnumerateCallback has invalid size");
-STATIC_ASSERT(sizeof(GetAuthenticationNonceRequest) == 8, "GetAuthenticationNonceRequest has invalid size");
-STATIC_ASSERT(sizeof(GetAuthenticationNonceResponse) == 12, "GetAuthenticationNonceResponse has invalid size");
-STATIC_ASSERT(sizeof(AuthenticateRequest) == 32, "AuthenticateRequest has invalid size");
-STATIC_ASSERT(sizeof(StackEnumerateRequest) == 8, "StackEnumerateRequest has invalid size");
-STATIC_ASSERT(sizeof(StackEnumerateResponse) == 72, "StackEnumerateResponse has invalid size");
-
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
 
-#define TRACE_BUFFER_SIZE 1000
+// two hex digits per byte value, indexed by byte value * 2
+static const char _hex_pairs[513] =
+	"000102030405060708090A0B0C0D0E0F"
+	"101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F"
+	"303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F"
+	"505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F"
+	"707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F"
+	"909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+	"B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+	"D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+	"F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+#define PACKET_ASSERT_SIZE(struct_, prefix, size, FIELDS) \
+	STATIC_ASSERT(sizeof(struct_) == size, #struct_ " has invalid size");
+
+PACKET_SCHEMA(PACKET_ASSERT_SIZE)
+
+// each ring takes PACKET_TRACE_DEFAULT_COUNT * sizeof(PacketTrace) bytes by
+// default, limit the number of rings to bound the memory used for tracing
+#define PACKET_TRACE_MAX_RINGS 64
+
+#define PCAPNG_BLOCK_TYPE_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_BLOCK_TYPE_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_BLOCK_TYPE_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_USER0 147
+#define PCAPNG_OPTION_END 0
+#define PCAPNG_OPTION_COMMENT 1
+#define PCAPNG_OPTION_PACKET_ID 5
 
 typedef struct {
+	uint64_t sequence; // index of the trace + 1, 0 while being written
 	uint64_t trace_id;
 	uint64_t timestamp; // microseconds
-	PacketHeader header;
 	const char *filename; // __FILE__
 	int line; // __LINE__
+	int length; // number of valid bytes in packet
+	uint8_t packet[sizeof(Packet)];
 } PacketTrace;
 
+typedef struct _PacketTraceRing PacketTraceRing;
+
+// each thread records its traces into its own ring, so there is no contention
+// between threads and each ring has a single writer
+struct _PacketTraceRing {
+	PacketTraceRing *next; // next ring in the list of all rings
+	PacketTraceRing *next_free; // next ring in the list of free rings
+	uint64_t next_index; // index of the next trace, only written by the owner
+	uint64_t flushed_index; // index of the next trace to write to the file
+	PacketTrace traces[];
+};
+
+typedef enum {
+	PACKET_TRACE_STATE_UNINITIALIZED = 0,
+	PACKET_TRACE_STATE_INITIALIZING,
+	PACKET_TRACE_STATE_RUNNING,
+	PACKET_TRACE_STATE_STOPPING,
+	PACKET_TRACE_STATE_STOPPED
+} PacketTraceState;
+
 static uint64_t _next_request_trace_id = 2; // start even
 static uint64_t _next_response_trace_id = UINT64_MAX; // start odd and high
-static PacketTrace _trace_buffer[TRACE_BUFFER_SIZE];
-static int _trace_buffer_used = 0;
-
+static int _trace_state = PACKET_TRACE_STATE_UNINITIALIZED;
+static PacketTraceRing *_trace_rings = NULL; // list of all rings, newest first
+static PacketTraceRing *_trace_free_rings = NULL; // rings of exited threads
+static int _trace_ring_count = 0;
+static Mutex _trace_rings_mutex; // protects the ring lists and count
+#ifndef _WIN32
+static pthread_key_t _trace_ring_key; // releases the ring of an exiting thread
+#endif
+#ifdef THREAD_LOCAL
+static THREAD_LOCAL PacketTraceRing *_trace_thread_ring = NULL;
+static THREAD_LOCAL bool _trace_thread_ring_unavailable = false;
+#else
+static PacketTraceRing *_trace_thread_ring = NULL; // unused, tracing is unavailable
+static bool _trace_thread_ring_unavailable = false;
+#endif
+static size_t _trace_ring_size = 0; // in bytes
+static uint64_t _trace_count = 0; // per ring, power of two
+static int64_t _trace_clock_offset = 0; // wall-clock minus monotonic microseconds
+static char _trace_filename[256] = PACKET_TRACE_DEFAULT_FILENAME;
+static Mutex _trace_flush_mutex;
+static Semaphore _trace_flush_semaphore;
+static Thread _trace_flush_thread;
+static bool _trace_flush_thread_running = false;
+static bool _trace_file_started = false; // later flushes append to the file
+
+// builds with DAEMONLIB_WITH_PACKET_TRACE trace from the start, otherwise
+// tracing has to be enabled by config option or at runtime
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+bool packet_trace_enabled = true;
+#else
+bool packet_trace_enabled = false;
 #endif
 
 int packet_header_is_valid_request(PacketHeader *header, const char **message) {
@@ -149,6 +232,71 @@ int packet_header_is_valid_response(PacketHeader *header, const char **message)
 	return 1;
 }
 
+// the batch validators check the same conditions as the single header
+// validators above. but instead of branching on each condition, all
+// conditions are evaluated and combined with bitwise operations. the range
+// check for the length uses unsigned wrap-around to fold both bounds into a
+// single comparison. this keeps the loop free of unpredictable branches, even
+// if valid and invalid headers are mixed.
+
+static uint64_t packet_header_is_invalid_request(PacketHeader *header) {
+	uint32_t length = header->length;
+
+	return (uint64_t)((length - sizeof(PacketHeader) > sizeof(Packet) - sizeof(PacketHeader)) |
+	                  (header->function_id == 0) |
+	                  ((header->sequence_number_and_options & 0xF0) == 0));
+}
+
+static uint64_t packet_header_is_invalid_response(PacketHeader *header) {
+	uint32_t length = header->length;
+
+	return (uint64_t)((length - sizeof(PacketHeader) > sizeof(Packet) - sizeof(PacketHeader)) |
+	                  (header->uid == 0) | // zero is zero in any byte order
+	                  (header->function_id == 0) |
+	                  ((header->sequence_number_and_options & 0x08) == 0));
+}
+
+// validates COUNT request HEADERS at once. for each invalid header the
+// corresponding bit in INVALID is set, bit i % 64 of INVALID[i / 64] for the
+// i-th header. INVALID has to have room for (COUNT + 63) / 64 elements. use
+// packet_header_is_valid_request to get a message for an invalid header.
+//
+// returns the number of invalid headers
+int packet_header_validate_requests(PacketHeader *const *headers, int count, uint64_t *invalid) {
+	int i;
+	uint64_t bad;
+	int total = 0;
+
+	memset(invalid, 0, sizeof(uint64_t) * ((count + 63) / 64));
+
+	for (i = 0; i < count; ++i) {
+		bad = packet_header_is_invalid_request(headers[i]);
+		invalid[i / 64] |= bad << (i % 64);
+		total += (int)bad;
+	}
+
+	return total;
+}
+
+// validates COUNT response HEADERS at once, see packet_header_validate_requests
+//
+// returns the number of invalid headers
+int packet_header_validate_responses(PacketHeader *const *headers, int count, uint64_t *invalid) {
+	int i;
+	uint64_t bad;
+	int total = 0;
+
+	memset(invalid, 0, sizeof(uint64_t) * ((count + 63) / 64));
+
+	for (i = 0; i < count; ++i) {
+		bad = packet_header_is_invalid_response(headers[i]);
+		invalid[i / 64] |= bad << (i % 64);
+		total += (int)bad;
+	}
+
+	return total;
+}
+
 uint8_t packet_header_get_sequence_number(PacketHeader *header) {
 	return (header->sequence_number_and_options >> 4) & 0x0F;
 }
@@ -197,75 +345,136 @@ const char *packet_get_response_type(Packet *packet) {
 	}
 }
 
+static char *packet_append_string(char *p, const char *string) {
+	while (*string != '\0') {
+		*p++ = *string++;
+	}
+
+	return p;
+}
+
+static char *packet_append_decimal(char *p, uint64_t value) {
+	char digits[20];
+	int count = 0;
+
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+
+	while (count > 0) {
+		*p++ = digits[--count];
+	}
+
+	return p;
+}
+
+// appends LENGTH bytes from DATA as space separated pairs of hex digits
+static char *packet_append_hex(char *p, const uint8_t *data, int length) {
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		memcpy(p, &_hex_pairs[data[i] * 2], 2);
+
+		p[2] = ' ';
+		p += 3;
+	}
+
+	return length > 0 ? p - 1 : p; // no trailing space
+}
+
+// formats the signature of PACKET into BUFFER, which needs room for at least
+// PACKET_MAX_SIGNATURE_LENGTH + 8 characters, and returns the end of it. this
+// replaces snprintf, as formatting signatures is the hot path of packet debug
+// logging. signatures longer than PACKET_MAX_SIGNATURE_LENGTH - 1 characters
+// get truncated afterwards, matching the previous snprintf behavior
+static char *packet_format_signature(char *buffer, Packet *packet, bool request) {
+	char *p = buffer;
+	uint8_t sequence_number = packet_header_get_sequence_number(&packet->header);
+
+	p = packet_append_string(p, "U: ");
+	base58_encode_cached(p, uint32_from_le(packet->header.uid));
+	p += strlen(p);
+	p = packet_append_string(p, ", L: ");
+	p = packet_append_decimal(p, packet->header.length);
+	p = packet_append_string(p, ", F: ");
+	p = packet_append_decimal(p, packet->header.function_id);
+
+	if (request) {
+		p = packet_append_string(p, ", S: ");
+		p = packet_append_decimal(p, sequence_number);
+		p = packet_append_string(p, packet_header_get_response_expected(&packet->header) ? ", R: 1" : ", R: 0");
+	} else if (sequence_number != 0) {
+		p = packet_append_string(p, ", S: ");
+		p = packet_append_decimal(p, sequence_number);
+		p = packet_append_string(p, ", E: ");
+		p = packet_append_decimal(p, packet_header_get_error_code(&packet->header));
+	}
+
+	// trace_id is only assigned while tracing is enabled, otherwise it is
+	// left over from whatever the packet buffer held before
+	p = packet_append_string(p, ", I: ");
+	p = packet_append_decimal(p, packet_trace_is_enabled() ? packet->trace_id : 0);
+
+	if (p - buffer > PACKET_MAX_SIGNATURE_LENGTH - 1) {
+		p = buffer + PACKET_MAX_SIGNATURE_LENGTH - 1;
+	}
+
+	*p = '\0';
+
+	return p;
+}
+
 char *packet_get_request_signature(char *signature, Packet *packet) {
-	char base58[BASE58_MAX_LENGTH];
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-	uint64_t trace_id = packet->trace_id;
-#else
-	uint64_t trace_id = 0;
-#endif
+	char buffer[PACKET_MAX_SIGNATURE_LENGTH + 8];
+	char *end = packet_format_signature(buffer, packet, true);
 
-	snprintf(signature, PACKET_MAX_SIGNATURE_LENGTH,
-	         "U: %s, L: %u, F: %u, S: %u, R: %d, I: %" PRIu64,
-	         base58_encode(base58, uint32_from_le(packet->header.uid)),
-	         packet->header.length,
-	         packet->header.function_id,
-	         packet_header_get_sequence_number(&packet->header),
-	         packet_header_get_response_expected(&packet->header) ? 1 : 0,
-	         trace_id);
+	memcpy(signature, buffer, end - buffer + 1);
 
 	return signature;
 }
 
 char *packet_get_response_signature(char *signature, Packet *packet) {
-	char base58[BASE58_MAX_LENGTH];
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-	uint64_t trace_id = packet->trace_id;
-#else
-	uint64_t trace_id = 0;
-#endif
+	char buffer[PACKET_MAX_SIGNATURE_LENGTH + 8];
+	char *end = packet_format_signature(buffer, packet, false);
 
-	if (packet_header_get_sequence_number(&packet->header) != 0) {
-		snprintf(signature, PACKET_MAX_SIGNATURE_LENGTH,
-		         "U: %s, L: %u, F: %u, S: %u, E: %d, I: %" PRIu64,
-		         base58_encode(base58, uint32_from_le(packet->header.uid)),
-		         packet->header.length,
-		         packet->header.function_id,
-		         packet_header_get_sequence_number(&packet->header),
-		         (int)packet_header_get_error_code(&packet->header),
-		         trace_id);
-	} else {
-		snprintf(signature, PACKET_MAX_SIGNATURE_LENGTH,
-		         "U: %s, L: %u, F: %u, I: %" PRIu64,
-		         base58_encode(base58, uint32_from_le(packet->header.uid)),
-		         packet->header.length,
-		         packet->header.function_id,
-		         trace_id);
-	}
+	memcpy(signature, buffer, end - buffer + 1);
 
 	return signature;
 }
 
 char *packet_get_content_dump(char *content_dump, Packet *packet, int length) {
-	int i;
-
 	if (length > (int)sizeof(Packet)) {
 		length = (int)sizeof(Packet);
 	}
 
-	for (i = 0; i < length; ++i) {
-		snprintf(content_dump + i * 3, 4, "%02X ", ((uint8_t *)packet)[i]);
-	}
-
-	if (length > 0) {
-		content_dump[length * 3 - 1] = '\0';
-	} else {
-		content_dump[0] = '\0';
-	}
+	*packet_append_hex(content_dump, (uint8_t *)packet, MAX(length, 0)) = '\0';
 
 	return content_dump;
 }
 
+// formats signature and content dump of a request or response PACKET in a
+// single pass as "<signature>, C: <content dump>" into DUMP, which needs room
+// for PACKET_MAX_DUMP_LENGTH characters. the content dump covers header.length
+// bytes of PACKET
+static char *packet_get_dump(char *dump, Packet *packet, bool request) {
+	char *p = packet_format_signature(dump, packet, request);
+
+	p = packet_append_string(p, ", C: ");
+	p = packet_append_hex(p, (uint8_t *)packet, MIN((int)packet->header.length, (int)sizeof(Packet)));
+	*p = '\0';
+
+	return dump;
+}
+
+char *packet_get_request_dump(char *dump, Packet *packet) {
+	return packet_get_dump(dump, packet, true);
+}
+
+char *packet_get_response_dump(char *dump, Packet *packet) {
+	return packet_get_dump(dump, packet, false);
+}
+
 bool packet_is_matching_response(Packet *packet, PacketHeader *pending_request) {
 	if (packet->header.uid != pending_request->uid) {
 		return false;
@@ -283,55 +492,537 @@ bool packet_is_matching_response(Packet *packet, PacketHeader *pending_request)
 	return true;
 }
 
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-
 uint64_t packet_get_next_request_trace_id(void) {
-	return __sync_fetch_and_add(&_next_request_trace_id, 2); // keep even
+	return atomic_fetch_add(&_next_request_trace_id, 2); // keep even
 }
 
 uint64_t packet_get_next_response_trace_id(void) {
-	return __sync_fetch_and_sub(&_next_response_trace_id, 2); // keep even
+	return atomic_fetch_add(&_next_response_trace_id, (uint64_t)-2); // keep odd
 }
 
-void packet_add_trace_(Packet *packet, const char *filename, int line) {
-	PacketTrace *trace = &_trace_buffer[_trace_buffer_used++];
-	FILE *fp;
-	int i;
+// writes LENGTH bytes from DATA followed by zero padding up to a multiple of
+// four bytes, as required for pcapng blocks
+static void packet_trace_write_padded(FILE *fp, const void *data, int length) {
+	static const uint8_t padding[3] = { 0, 0, 0 };
+
+	fwrite(data, 1, length, fp);
+	fwrite(padding, 1, (4 - length % 4) % 4, fp);
+}
+
+// the file is written in host byte order, as indicated by the byte order magic.
+// fields that are two uint16 values are written as such, combining them into
+// one uint32 would swap them on big endian hosts
+static void packet_trace_write_header(FILE *fp) {
+	uint32_t section[7];
+	uint16_t version[2] = { 1, 0 }; // major, minor
+	uint32_t interface[5];
+	uint16_t linktype[2] = { PCAPNG_LINKTYPE_USER0, 0 }; // and 16 reserved bits
+
+	section[0] = PCAPNG_BLOCK_TYPE_SECTION_HEADER;
+	section[1] = sizeof(section);
+	section[2] = PCAPNG_BYTE_ORDER_MAGIC;
+	memcpy(&section[3], version, sizeof(version));
+	section[4] = 0xFFFFFFFF; // section length is not specified
+	section[5] = 0xFFFFFFFF;
+	section[6] = sizeof(section);
+
+	fwrite(section, 1, sizeof(section), fp);
+
+	// the default timestamp resolution of pcapng is microseconds
+	interface[0] = PCAPNG_BLOCK_TYPE_INTERFACE_DESCRIPTION;
+	interface[1] = sizeof(interface);
+	memcpy(&interface[2], linktype, sizeof(linktype));
+	interface[3] = sizeof(Packet); // snap length
+	interface[4] = sizeof(interface);
+
+	fwrite(interface, 1, sizeof(interface), fp);
+}
+
+// writes TRACE as enhanced packet block. the trace ID is stored as packet ID
+// and the source location as comment
+static void packet_trace_write_trace(FILE *fp, PacketTrace *trace) {
+	char comment[128];
+	int comment_length;
+	uint32_t block[7];
+	uint16_t option[2];
+	uint64_t timestamp = trace->timestamp + _trace_clock_offset;
+	uint32_t length;
+
+	comment_length = snprintf(comment, sizeof(comment), "%s:%d", trace->filename, trace->line);
+	comment_length = MIN(MAX(comment_length, 0), (int)sizeof(comment) - 1);
+
+	length = sizeof(block) + (trace->length + 3) / 4 * 4 + // block and packet
+	         4 + (comment_length + 3) / 4 * 4 + // comment option
+	         4 + sizeof(trace->trace_id) + // packet ID option
+	         4 + // end option
+	         4; // trailing block length
+
+	block[0] = PCAPNG_BLOCK_TYPE_ENHANCED_PACKET;
+	block[1] = length;
+	block[2] = 0; // interface ID
+	block[3] = timestamp >> 32;
+	block[4] = timestamp & 0xFFFFFFFF;
+	block[5] = trace->length; // captured length
+	block[6] = trace->length; // original length
+
+	fwrite(block, 1, sizeof(block), fp);
+	packet_trace_write_padded(fp, trace->packet, trace->length);
+
+	option[0] = PCAPNG_OPTION_COMMENT;
+	option[1] = comment_length;
+
+	fwrite(option, 1, sizeof(option), fp);
+	packet_trace_write_padded(fp, comment, comment_length);
+
+	option[0] = PCAPNG_OPTION_PACKET_ID;
+	option[1] = sizeof(trace->trace_id);
+
+	fwrite(option, 1, sizeof(option), fp);
+	fwrite(&trace->trace_id, 1, sizeof(trace->trace_id), fp);
+
+	option[0] = PCAPNG_OPTION_END;
+	option[1] = 0;
+
+	fwrite(option, 1, sizeof(option), fp);
+	fwrite(&length, 1, sizeof(length), fp);
+}
+
+// copies the trace with the given INDEX from RING. returns false if the trace
+// is being written or was already overwritten by a newer one
+static bool packet_trace_read(PacketTraceRing *ring, uint64_t index, PacketTrace *trace) {
+	PacketTrace *slot = &ring->traces[index & (_trace_count - 1)];
+
+	if (atomic_load_acquire(&slot->sequence) != index + 1) {
+		return false;
+	}
+
+	memcpy(trace, slot, sizeof(PacketTrace));
+
+	// check that the slot was not reused while copying it
+	atomic_fence();
+
+	return atomic_load_relaxed(&slot->sequence) == index + 1 &&
+	       trace->length >= 0 && trace->length <= (int)sizeof(Packet);
+}
+
+static void packet_trace_flush_thread(void *opaque) {
+	(void)opaque;
+
+	for (;;) {
+		semaphore_acquire(&_trace_flush_semaphore);
+
+		if (!_trace_flush_thread_running) {
+			break;
+		}
+
+		packet_trace_flush();
+	}
+}
+
+// returns a ring with room for _trace_count traces or NULL on error (sets
+// errno). the ring of an exited thread is reused if there is one, otherwise a
+// new ring is created and added to the list of all rings. a reused ring keeps
+// its traces and continues at its next index, it has a single writer at a time
+static PacketTraceRing *packet_trace_acquire_ring(void) {
+	PacketTraceRing *ring;
+
+	mutex_lock(&_trace_rings_mutex);
+
+	if (_trace_free_rings != NULL) {
+		ring = _trace_free_rings;
+		_trace_free_rings = ring->next_free;
+
+		mutex_unlock(&_trace_rings_mutex);
+
+		return ring;
+	}
+
+	if (_trace_ring_count >= PACKET_TRACE_MAX_RINGS) {
+		mutex_unlock(&_trace_rings_mutex);
+
+		errno = ENOSPC;
+
+		return NULL;
+	}
+
+	++_trace_ring_count;
+
+	mutex_unlock(&_trace_rings_mutex);
+
+#ifdef _WIN32
+	ring = calloc(1, _trace_ring_size);
 
-	trace->trace_id = packet->trace_id;
-	trace->timestamp = microseconds();
-	trace->header = packet->header;
-	trace->filename = filename;
-	trace->line = line;
+	if (ring == NULL) {
+		errno = ENOMEM;
+	}
+#else
+	// the ring is mapped instead of allocated to get it directly from the
+	// kernel, untouched pages are not backed by physical memory until used
+	ring = mmap(NULL, _trace_ring_size, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (ring == MAP_FAILED) {
+		ring = NULL;
+	}
+#endif
+
+	mutex_lock(&_trace_rings_mutex);
+
+	if (ring == NULL) {
+		--_trace_ring_count;
+	} else {
+		ring->next = _trace_rings;
+		_trace_rings = ring;
+	}
+
+	mutex_unlock(&_trace_rings_mutex);
+
+	return ring;
+}
+
+#ifndef _WIN32
+
+// called on exit of a thread that has a ring. the ring stays in the list of all
+// rings, so that its traces still get written, and is reused by the next thread
+// that starts tracing. without this every short-lived thread would keep a ring
+static void packet_trace_release_ring(void *opaque) {
+	PacketTraceRing *ring = opaque;
+
+	mutex_lock(&_trace_rings_mutex);
+
+	ring->next_free = _trace_free_rings;
+	_trace_free_rings = ring;
 
-	if (_trace_buffer_used == TRACE_BUFFER_SIZE) {
-		log_info("Writing packet trace to /tmp/brick-packet-trace");
+	mutex_unlock(&_trace_rings_mutex);
+}
+
+#endif
+
+// sets up per-thread trace rings with room for COUNT (> 0) traces each, rounded
+// up to the next power of two, and starts the background thread that writes
+// the traces to FILENAME (or PACKET_TRACE_DEFAULT_FILENAME if NULL) in pcapng
+// format each time half of a ring got filled. calling this is optional, the
+// first traced packet initializes tracing with PACKET_TRACE_DEFAULT_COUNT
+// traces. the ring of a thread is created when it traces its first packet and
+// is reused by another thread after the thread exited. at most
+// PACKET_TRACE_MAX_RINGS threads can trace at the same time.
+// packet_trace_exit is registered with atexit, so that the background thread
+// is stopped and the remaining traces are written even if the daemon doesn't
+// call it. daemons should still call it before log_exit, so that errors during
+// the final write can be logged. if the daemon defines the packet_trace.enabled boolean config option and it
+// is set then tracing gets enabled here.
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_trace_init(int count, const char *filename) {
+	int state = PACKET_TRACE_STATE_UNINITIALIZED;
+	uint64_t rounded_count = 1;
+	struct timeval tv;
+
+	if (count <= 0) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+#ifndef THREAD_LOCAL
+	// the per-thread rings need thread-local storage
+	errno = ENOSYS;
+
+	return -1;
+#endif
 
-		fp = fopen("/tmp/brick-packet-trace", "wb");
+	if (config_get_option_value("packet_trace.enabled")->boolean) {
+		atomic_store_release(&packet_trace_enabled, true);
+	}
+
+	if (!atomic_compare_exchange(&_trace_state, &state, PACKET_TRACE_STATE_INITIALIZING)) {
+		errno = EALREADY;
+
+		return -1;
+	}
 
-		if (fp == NULL) {
-			_trace_buffer_used = 0;
+	while (rounded_count < (uint64_t)count) {
+		rounded_count *= 2;
+	}
+
+	_trace_ring_size = sizeof(PacketTraceRing) + sizeof(PacketTrace) * rounded_count;
 
-			log_error("Could not open /tmp/brick-packet-trace");
+	if (filename != NULL) {
+		string_copy(_trace_filename, sizeof(_trace_filename), filename, -1);
+	}
 
+	// the traces use the monotonic clock, pcapng needs the wall-clock
+	if (gettimeofday(&tv, NULL) == 0) {
+		_trace_clock_offset = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (int64_t)microseconds();
+	}
+
+	_trace_count = rounded_count;
+
+	mutex_create(&_trace_rings_mutex);
+	mutex_create(&_trace_flush_mutex);
+#ifndef _WIN32
+	// on Windows rings are not reused, PACKET_TRACE_MAX_RINGS still bounds them
+	pthread_key_create(&_trace_ring_key, packet_trace_release_ring);
+#endif
+	semaphore_create(&_trace_flush_semaphore);
+
+	_trace_flush_thread_running = true;
+
+	thread_create(&_trace_flush_thread, packet_trace_flush_thread, NULL);
+
+	atomic_store_release(&_trace_state, PACKET_TRACE_STATE_RUNNING);
+
+	// tracing can only be initialized once, so this is registered only once
+	atexit(packet_trace_exit);
+
+	return 0;
+}
+
+// stops the background thread and writes the remaining traces. other threads
+// might still be tracing while this is called at exit, therefore the rings and
+// the synchronization primitives are left alive for them and are released by
+// the operating system. calling this more than once or without tracing being
+// initialized is harmless
+void packet_trace_exit(void) {
+	int state = PACKET_TRACE_STATE_RUNNING;
+
+	if (!atomic_compare_exchange(&_trace_state, &state, PACKET_TRACE_STATE_STOPPING)) {
+		return;
+	}
+
+	_trace_flush_thread_running = false;
+
+	semaphore_release(&_trace_flush_semaphore);
+	thread_join(&_trace_flush_thread);
+	thread_destroy(&_trace_flush_thread);
+
+	packet_trace_flush();
+
+	atomic_store_release(&_trace_state, PACKET_TRACE_STATE_STOPPED);
+}
+
+bool packet_trace_is_enabled(void) {
+	return atomic_load_relaxed(&packet_trace_enabled);
+}
+
+// enables or disables recording of packet traces at runtime. disabling it
+// makes the background thread write the traces recorded so far to the trace
+// file, so that toggling the trace on and off brackets the interesting part.
+// the file is not written by the calling thread, as this is typically called
+// from the event loop
+void packet_trace_set_enabled(bool enabled) {
+	if (atomic_exchange(&packet_trace_enabled, enabled) == enabled) {
+		return;
+	}
+
+	log_info("Packet tracing %s", enabled ? "enabled" : "disabled");
+
+	if (!enabled && atomic_load_acquire(&_trace_state) == PACKET_TRACE_STATE_RUNNING) {
+		semaphore_release(&_trace_flush_semaphore);
+	}
+}
+
+// records PACKET (header.length bytes of it) with a timestamp and the source
+// location into the ring of the calling thread. apart from creating the ring
+// on first use this doesn't synchronize with other threads at all. once the
+// ring is full the oldest traces get overwritten.
+void packet_add_trace_(Packet *packet, const char *filename, int line) {
+	PacketTraceRing *ring = _trace_thread_ring;
+	uint64_t index;
+	PacketTrace *slot;
+	int length;
+
+	if (atomic_load_acquire(&_trace_state) != PACKET_TRACE_STATE_RUNNING) {
+		if (atomic_load_relaxed(&_trace_state) != PACKET_TRACE_STATE_UNINITIALIZED ||
+		    packet_trace_init(PACKET_TRACE_DEFAULT_COUNT, NULL) < 0) {
+			return; // initializing concurrently, stopped or failed
+		}
+	}
+
+	if (ring == NULL) {
+		if (_trace_thread_ring_unavailable) {
 			return;
 		}
 
-		for (i = 0; i < _trace_buffer_used; ++i) {
-			trace = &_trace_buffer[i];
+		ring = packet_trace_acquire_ring();
+
+		if (ring == NULL) {
+			// don't try again for every packet of this thread
+			_trace_thread_ring_unavailable = true;
 
-			fwrite(&trace->trace_id, 1, sizeof(trace->trace_id), fp);
-			fwrite(&trace->timestamp, 1, sizeof(trace->timestamp), fp);
-			fwrite(&trace->header, 1, sizeof(trace->header), fp);
-			fwrite(trace->filename, 1, strlen(trace->filename) + 1, fp);
-			fwrite(&trace->line, 1, sizeof(trace->line), fp);
+			return;
 		}
 
-		fflush(fp);
-		fclose(fp);
+#ifndef _WIN32
+		pthread_setspecific(_trace_ring_key, ring);
+#endif
+
+		_trace_thread_ring = ring;
+	}
+
+	// only this thread writes next_index, the flush reads it concurrently
+	index = atomic_load_relaxed(&ring->next_index);
+	slot = &ring->traces[index & (_trace_count - 1)];
+	length = MIN(MAX((int)packet->header.length, (int)sizeof(PacketHeader)), (int)sizeof(Packet));
+
+	atomic_store_relaxed(&slot->sequence, 0);
+
+	// make the slot invalid before overwriting it
+	atomic_fence_release();
+
+	slot->trace_id = packet->trace_id;
+	slot->timestamp = microseconds();
+	slot->filename = filename;
+	slot->line = line;
+	slot->length = length;
 
-		_trace_buffer_used = 0;
+	memcpy(slot->packet, packet, length);
+
+	atomic_store_release(&slot->sequence, index + 1);
+	atomic_store_release(&ring->next_index, index + 1);
+
+	// wake up the background thread each time half of a ring got filled
+	if (((index + 1) & (_trace_count / 2 - 1)) == 0) {
+		semaphore_release(&_trace_flush_semaphore);
 	}
 }
 
-#endif
+typedef struct {
+	PacketTraceRing *ring;
+	uint64_t index; // of the next trace to read
+	uint64_t end;
+	PacketTrace trace; // the oldest trace not yet written
+} PacketTraceCursor;
+
+// reads the next valid trace of the cursor's ring. returns false if there is
+// none left
+static bool packet_trace_advance(PacketTraceCursor *cursor) {
+	while (cursor->index < cursor->end) {
+		if (packet_trace_read(cursor->ring, cursor->index++, &cursor->trace)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// appends the traces recorded since the last flush to the trace file in pcapng
+// format. the first flush truncates the file and writes the pcapng header. the
+// traces of each ring are ordered by time already, they are merged oldest
+// first. traces that are overwritten before they got written are skipped. this
+// is called by the background thread, but can also be called to write the
+// traces on demand.
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_trace_flush(void) {
+	int state = atomic_load_acquire(&_trace_state);
+	PacketTraceRing *rings;
+	PacketTraceRing *ring;
+	int cursor_count = 0;
+	PacketTraceCursor *cursors;
+	PacketTraceCursor *cursor;
+	PacketTraceCursor *oldest;
+	int i;
+	FILE *fp;
+	int saved_errno;
+
+	if (state != PACKET_TRACE_STATE_RUNNING && state != PACKET_TRACE_STATE_STOPPING) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	mutex_lock(&_trace_flush_mutex);
+
+	// rings are only added to the front of the list, a snapshot of its
+	// head can be walked without holding the mutex
+	mutex_lock(&_trace_rings_mutex);
+
+	rings = _trace_rings;
+
+	mutex_unlock(&_trace_rings_mutex);
+
+	for (ring = rings; ring != NULL; ring = ring->next) {
+		++cursor_count;
+	}
+
+	cursors = calloc(MAX(cursor_count, 1), sizeof(PacketTraceCursor));
+
+	if (cursors == NULL) {
+		mutex_unlock(&_trace_flush_mutex);
+
+		log_error("Could not allocate packet trace cursors: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	fp = fopen(_trace_filename, _trace_file_started ? "ab" : "wb");
+
+	if (fp == NULL) {
+		saved_errno = errno;
+
+		free(cursors);
+		mutex_unlock(&_trace_flush_mutex);
+
+		log_error("Could not open packet trace file %s: %s (%d)",
+		          _trace_filename, get_errno_name(saved_errno), saved_errno);
+
+		errno = saved_errno;
+
+		return -1;
+	}
+
+	if (!_trace_file_started) {
+		packet_trace_write_header(fp);
+
+		_trace_file_started = true;
+	}
+
+	for (ring = rings, i = 0; ring != NULL; ring = ring->next, ++i) {
+		cursor = &cursors[i];
+		cursor->ring = ring;
+		cursor->end = atomic_load_acquire(&ring->next_index);
+		cursor->index = cursor->end > _trace_count ? cursor->end - _trace_count : 0;
+		cursor->index = MAX(cursor->index, ring->flushed_index);
+		ring->flushed_index = cursor->end;
+
+		if (!packet_trace_advance(cursor)) {
+			cursor->ring = NULL;
+		}
+	}
+
+	// the number of rings equals the number of tracing threads, it's small
+	// enough to find the oldest trace by a linear search
+	for (;;) {
+		oldest = NULL;
+
+		for (i = 0; i < cursor_count; ++i) {
+			cursor = &cursors[i];
+
+			if (cursor->ring != NULL &&
+			    (oldest == NULL || cursor->trace.timestamp < oldest->trace.timestamp)) {
+				oldest = cursor;
+			}
+		}
+
+		if (oldest == NULL) {
+			break;
+		}
+
+		packet_trace_write_trace(fp, &oldest->trace);
+
+		if (!packet_trace_advance(oldest)) {
+			oldest->ring = NULL;
+		}
+	}
+
+	fclose(fp);
+	free(cursors);
+
+	mutex_unlock(&_trace_flush_mutex);
+
+	return 0;
+}
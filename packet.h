@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2014, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * packet.h: Packet definiton for protocol version 2
  *
@@ -25,6 +25,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "macros.h"
+
 typedef enum {
 	FUNCTION_DISCONNECT_PROBE = 128,
 	FUNCTION_GET_PROTOCOL1_BRICKLET_NAME = 241,
@@ -62,6 +64,7 @@ typedef enum {
 
 #define PACKET_MAX_SIGNATURE_LENGTH 64
 #define PACKET_MAX_CONTENT_DUMP_LENGTH ((int)sizeof(Packet) * 3 + 1)
+#define PACKET_MAX_DUMP_LENGTH (PACKET_MAX_SIGNATURE_LENGTH + 8 + PACKET_MAX_CONTENT_DUMP_LENGTH)
 #define PACKET_MAX_STACK_ENUMERATE_UIDS 16
 
 #include "packed_begin.h"
@@ -79,60 +82,68 @@ typedef struct {
 	uint8_t payload[64];
 	union {
 		uint8_t optional_data[8];
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
 		uint64_t trace_id; // zero == invalid, even == request, odd == response
-#endif
 	};
 } ATTRIBUTE_PACKED Packet;
 
-typedef struct {
-	PacketHeader header;
-	char uid[8];
-	char connected_uid[8];
-	char position;
-	uint8_t hardware_version[3];
-	uint8_t firmware_version[3];
-	uint16_t device_identifier; // always little endian
-	uint8_t enumeration_type;
-} ATTRIBUTE_PACKED EnumerateCallback;
-
-typedef struct {
-	PacketHeader header;
-} ATTRIBUTE_PACKED EmptyResponse;
-
-typedef struct {
-	PacketHeader header;
-} ATTRIBUTE_PACKED GetAuthenticationNonceRequest;
-
-typedef struct {
-	PacketHeader header;
-	uint8_t server_nonce[4];
-} ATTRIBUTE_PACKED GetAuthenticationNonceResponse;
-
-typedef struct {
-	PacketHeader header;
-	uint8_t client_nonce[4];
-	uint8_t digest[20];
-} ATTRIBUTE_PACKED AuthenticateRequest;
-
-typedef struct {
-	PacketHeader header;
-} ATTRIBUTE_PACKED AuthenticateResponse;
-
-typedef struct {
-	PacketHeader header;
-} ATTRIBUTE_PACKED StackEnumerateRequest;
-
-typedef struct {
-	PacketHeader header;
-	uint32_t uids[PACKET_MAX_STACK_ENUMERATE_UIDS];
-} ATTRIBUTE_PACKED StackEnumerateResponse;
+// the packet layouts following the header are described by an X-macro schema.
+// it generates the packed structs, their size checks, accessors that convert
+// multi-byte fields from and to little endian and a length validator. each
+// PACKET entry gives the struct name, the prefix of the generated functions,
+// the expected size in bytes and the list of fields. each field list calls
+// SCALAR(struct, prefix, type, kind, name) or ARRAY(struct, prefix, type,
+// kind, name, length) per field. KIND selects the endian conversion and is one
+// of char, uint8, uint16 or uint32. multi-byte fields are always stored in
+// little endian.
+#define PACKET_SCHEMA(PACKET) \
+	PACKET(EnumerateCallback, enumerate_callback, 34, PACKET_FIELDS_ENUMERATE_CALLBACK) \
+	PACKET(EmptyResponse, empty_response, 8, PACKET_FIELDS_NONE) \
+	PACKET(GetAuthenticationNonceRequest, get_authentication_nonce_request, 8, PACKET_FIELDS_NONE) \
+	PACKET(GetAuthenticationNonceResponse, get_authentication_nonce_response, 12, PACKET_FIELDS_GET_AUTHENTICATION_NONCE_RESPONSE) \
+	PACKET(AuthenticateRequest, authenticate_request, 32, PACKET_FIELDS_AUTHENTICATE_REQUEST) \
+	PACKET(AuthenticateResponse, authenticate_response, 8, PACKET_FIELDS_NONE) \
+	PACKET(StackEnumerateRequest, stack_enumerate_request, 8, PACKET_FIELDS_NONE) \
+	PACKET(StackEnumerateResponse, stack_enumerate_response, 72, PACKET_FIELDS_STACK_ENUMERATE_RESPONSE)
+
+#define PACKET_FIELDS_NONE(SCALAR, ARRAY, struct_, prefix)
+
+#define PACKET_FIELDS_ENUMERATE_CALLBACK(SCALAR, ARRAY, struct_, prefix) \
+	ARRAY(struct_, prefix, char, char, uid, 8) \
+	ARRAY(struct_, prefix, char, char, connected_uid, 8) \
+	SCALAR(struct_, prefix, char, char, position) \
+	ARRAY(struct_, prefix, uint8_t, uint8, hardware_version, 3) \
+	ARRAY(struct_, prefix, uint8_t, uint8, firmware_version, 3) \
+	SCALAR(struct_, prefix, uint16_t, uint16, device_identifier) \
+	SCALAR(struct_, prefix, uint8_t, uint8, enumeration_type)
+
+#define PACKET_FIELDS_GET_AUTHENTICATION_NONCE_RESPONSE(SCALAR, ARRAY, struct_, prefix) \
+	ARRAY(struct_, prefix, uint8_t, uint8, server_nonce, 4)
+
+#define PACKET_FIELDS_AUTHENTICATE_REQUEST(SCALAR, ARRAY, struct_, prefix) \
+	ARRAY(struct_, prefix, uint8_t, uint8, client_nonce, 4) \
+	ARRAY(struct_, prefix, uint8_t, uint8, digest, 20)
+
+#define PACKET_FIELDS_STACK_ENUMERATE_RESPONSE(SCALAR, ARRAY, struct_, prefix) \
+	ARRAY(struct_, prefix, uint32_t, uint32, uids, PACKET_MAX_STACK_ENUMERATE_UIDS)
+
+#define PACKET_STRUCT_SCALAR(struct_, prefix, type, kind, name) type name;
+#define PACKET_STRUCT_ARRAY(struct_, prefix, type, kind, name, length) type name[length];
+#define PACKET_STRUCT(struct_, prefix, size, FIELDS) \
+	typedef struct { \
+		PacketHeader header; \
+		FIELDS(PACKET_STRUCT_SCALAR, PACKET_STRUCT_ARRAY, struct_, prefix) \
+	} ATTRIBUTE_PACKED struct_;
+
+PACKET_SCHEMA(PACKET_STRUCT)
 
 #include "packed_end.h"
 
 int packet_header_is_valid_request(PacketHeader *header, const char **message);
 int packet_header_is_valid_response(PacketHeader *header, const char **message);
 
+int packet_header_validate_requests(PacketHeader *const *headers, int count, uint64_t *invalid);
+int packet_header_validate_responses(PacketHeader *const *headers, int count, uint64_t *invalid);
+
 uint8_t packet_header_get_sequence_number(PacketHeader *header);
 void packet_header_set_sequence_number(PacketHeader *header, uint8_t sequence_number);
 
@@ -148,20 +159,90 @@ char *packet_get_request_signature(char *signature, Packet *packet);
 char *packet_get_response_signature(char *signature, Packet *packet);
 char *packet_get_content_dump(char *content_dump, Packet *packet, int length);
 
+char *packet_get_request_dump(char *dump, Packet *packet);
+char *packet_get_response_dump(char *dump, Packet *packet);
+
 bool packet_is_matching_response(Packet *packet, PacketHeader *pending_request);
 
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
+// the endian conversion for each field kind of the packet schema. single-byte
+// kinds need none. the multi-byte kinds need none on little endian hosts, on
+// big endian hosts their bytes are swapped, which converts in both directions
+#define PACKET_FROM_LE_char(value) (value)
+#define PACKET_FROM_LE_uint8(value) (value)
 
-#define packet_add_trace(packet) packet_add_trace_(packet, __FILE__, __LINE__)
+#if (defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined _WIN32
+	#define PACKET_FROM_LE_uint16(value) (value)
+	#define PACKET_FROM_LE_uint32(value) (value)
+#else
+	STATIC_INLINE uint16_t packet_swap_uint16(uint16_t value) {
+		return (uint16_t)(value >> 8 | value << 8);
+	}
+
+	STATIC_INLINE uint32_t packet_swap_uint32(uint32_t value) {
+		return (value >> 24) | ((value >> 8) & 0x0000FF00) |
+		       ((value << 8) & 0x00FF0000) | (value << 24);
+	}
+
+	#define PACKET_FROM_LE_uint16(value) packet_swap_uint16(value)
+	#define PACKET_FROM_LE_uint32(value) packet_swap_uint32(value)
+#endif
+
+#define PACKET_TO_LE_char(value) PACKET_FROM_LE_char(value)
+#define PACKET_TO_LE_uint8(value) PACKET_FROM_LE_uint8(value)
+#define PACKET_TO_LE_uint16(value) PACKET_FROM_LE_uint16(value)
+#define PACKET_TO_LE_uint32(value) PACKET_FROM_LE_uint32(value)
+
+// the accessors are defined inline, so that a field access compiles to a
+// plain load or store on little endian hosts
+#define PACKET_DEFINE_SCALAR(struct_, prefix, type, kind, name) \
+	STATIC_INLINE type prefix##_get_##name(struct_ *packet) { \
+		return PACKET_FROM_LE_##kind(packet->name); \
+	} \
+	STATIC_INLINE void prefix##_set_##name(struct_ *packet, type value) { \
+		packet->name = PACKET_TO_LE_##kind(value); \
+	}
+
+// INDEX is not range checked, the caller has to ensure 0 <= INDEX < LENGTH
+#define PACKET_DEFINE_ARRAY(struct_, prefix, type, kind, name, length) \
+	STATIC_INLINE type prefix##_get_##name(struct_ *packet, int index) { \
+		return PACKET_FROM_LE_##kind(packet->name[index]); \
+	} \
+	STATIC_INLINE void prefix##_set_##name(struct_ *packet, int index, type value) { \
+		packet->name[index] = PACKET_TO_LE_##kind(value); \
+	}
+
+// a packet is valid if its header reports the size of its struct
+#define PACKET_DEFINE(struct_, prefix, size, FIELDS) \
+	STATIC_INLINE bool prefix##_is_valid(struct_ *packet) { \
+		return packet->header.length == sizeof(struct_); \
+	} \
+	FIELDS(PACKET_DEFINE_SCALAR, PACKET_DEFINE_ARRAY, struct_, prefix)
+
+PACKET_SCHEMA(PACKET_DEFINE)
+
+#define PACKET_TRACE_DEFAULT_COUNT 16384
+#define PACKET_TRACE_DEFAULT_FILENAME "/tmp/brick-packet-trace.pcapng"
+
+extern bool packet_trace_enabled;
+
+// the enabled check is done inline, while tracing is disabled the cost of a
+// packet_add_trace call is a single well predicted branch
+#define packet_add_trace(packet) do { \
+		if (PREDICT_FALSE(packet_trace_enabled)) { \
+			packet_add_trace_(packet, __FILE__, __LINE__); \
+		} \
+	} while (0)
 
 uint64_t packet_get_next_request_trace_id(void);
 uint64_t packet_get_next_response_trace_id(void);
-void packet_add_trace_(Packet *packet, const char *filename, int line);
 
-#else
+int packet_trace_init(int count, const char *filename);
+void packet_trace_exit(void);
 
-#define packet_add_trace(packet) ((void)(packet))
+bool packet_trace_is_enabled(void);
+void packet_trace_set_enabled(bool enabled);
 
-#endif
+void packet_add_trace_(Packet *packet, const char *filename, int line);
+int packet_trace_flush(void);
 
 #endif // DAEMONLIB_PACKET_H
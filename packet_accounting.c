@@ -0,0 +1,285 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_accounting.c: Per UID and function ID packet traffic accounting
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a PacketAccounting object counts requests, responses, callbacks, errors and
+ * bytes per uid and function ID. this allows to find the device or function
+ * that floods the daemon without enabling debug logging for all packets.
+ *
+ * the counters are kept in a HashTable keyed on uid and function ID. the table
+ * is bounded to a maximum number of entries, so that bogus uids cannot make
+ * it grow without limit. traffic for new keys beyond this limit is added to a
+ * single overflow entry instead. resetting the counters also removes all
+ * entries, so that a burst of bogus uids can only fill the table until then.
+ *
+ * there is no locking, a PacketAccounting object has to be used from a single
+ * thread only, typically the event loop thread.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_accounting.h"
+
+#include "base58.h"
+#include "log.h"
+#include "utils.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	PacketAccounting *accounting;
+	int remaining; // number of lines left to log
+} PacketAccountingLogState;
+
+static uint64_t packet_accounting_get_key(PacketHeader *header) {
+	return (uint64_t)header->uid | (uint64_t)header->function_id << 32;
+}
+
+// returns the entry for the uid and function ID of HEADER. if there is none
+// yet then a new one is added or the overflow entry is returned if the table
+// is full or the new entry could not be allocated
+static PacketAccountingEntry *packet_accounting_get_entry(PacketAccounting *accounting,
+                                                          PacketHeader *header) {
+	uint64_t key = packet_accounting_get_key(header);
+	PacketAccountingEntry *entry = hash_table_get_integer(&accounting->entries, key);
+
+	if (entry != NULL) {
+		return entry;
+	}
+
+	if (accounting->entries.count < accounting->max_entries) {
+		entry = hash_table_insert_integer(&accounting->entries, key);
+
+		if (entry != NULL) {
+			entry->uid = uint32_from_le(header->uid);
+			entry->function_id = header->function_id;
+
+			return entry;
+		}
+	}
+
+	accounting->overflowed = true;
+
+	return &accounting->overflow;
+}
+
+static int packet_accounting_compare_entries(const void *a, const void *b) {
+	PacketAccountingEntry *entry_a = *(PacketAccountingEntry **)a;
+	PacketAccountingEntry *entry_b = *(PacketAccountingEntry **)b;
+	uint64_t bytes_a = entry_a->request_bytes + entry_a->response_bytes;
+	uint64_t bytes_b = entry_b->request_bytes + entry_b->response_bytes;
+
+	// most bytes first
+	return bytes_a < bytes_b ? 1 : (bytes_a > bytes_b ? -1 : 0);
+}
+
+// creates an empty PacketAccounting object that tracks up to MAX_ENTRIES (> 0)
+// different uid and function ID pairs
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_accounting_create(PacketAccounting *accounting, int max_entries) {
+	if (max_entries <= 0) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	if (hash_table_create(&accounting->entries, 0, sizeof(PacketAccountingEntry),
+	                      HASH_TABLE_KEY_TYPE_INTEGER) < 0) {
+		return -1;
+	}
+
+	accounting->max_entries = max_entries;
+
+	memset(&accounting->overflow, 0, sizeof(PacketAccountingEntry));
+
+	accounting->overflowed = false;
+
+	return 0;
+}
+
+void packet_accounting_destroy(PacketAccounting *accounting) {
+	hash_table_destroy(&accounting->entries, NULL);
+}
+
+void packet_accounting_add_request(PacketAccounting *accounting, Packet *request) {
+	PacketAccountingEntry *entry = packet_accounting_get_entry(accounting, &request->header);
+
+	++entry->requests;
+	entry->request_bytes += request->header.length;
+}
+
+// adds RESPONSE as callback if its sequence number is 0, as response otherwise
+void packet_accounting_add_response(PacketAccounting *accounting, Packet *response) {
+	PacketAccountingEntry *entry = packet_accounting_get_entry(accounting, &response->header);
+
+	if (packet_header_get_sequence_number(&response->header) == 0) {
+		++entry->callbacks;
+	} else {
+		++entry->responses;
+	}
+
+	if (packet_header_get_error_code(&response->header) != PACKET_E_SUCCESS) {
+		++entry->errors;
+	}
+
+	entry->response_bytes += response->header.length;
+}
+
+// sets all counters to zero and removes all entries from the table. otherwise
+// uids that are gone would keep their entries and could push the traffic of
+// new uids into the overflow entry for the rest of the process lifetime. if
+// the new table cannot be allocated then the entries are kept with their
+// counters set to zero.
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_accounting_reset(PacketAccounting *accounting) {
+	HashTable entries;
+	HashTableIterator iterator;
+	PacketAccountingEntry *entry;
+	uint32_t uid;
+	uint8_t function_id;
+
+	memset(&accounting->overflow, 0, sizeof(PacketAccountingEntry));
+
+	accounting->overflowed = false;
+
+	if (hash_table_create(&entries, 0, sizeof(PacketAccountingEntry),
+	                      HASH_TABLE_KEY_TYPE_INTEGER) >= 0) {
+		hash_table_destroy(&accounting->entries, NULL);
+
+		accounting->entries = entries;
+
+		return 0;
+	}
+
+	hash_table_iterator_init(&iterator);
+
+	while ((entry = hash_table_iterate(&accounting->entries, &iterator)) != NULL) {
+		uid = entry->uid;
+		function_id = entry->function_id;
+
+		memset(entry, 0, sizeof(PacketAccountingEntry));
+
+		entry->uid = uid;
+		entry->function_id = function_id;
+	}
+
+	errno = ENOMEM;
+
+	return -1;
+}
+
+// calls FUNCTION for each entry, ordered by the number of bytes from most to
+// least. the overflow entry is passed last, if there was an overflow
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_accounting_dump(PacketAccounting *accounting,
+                           PacketAccountingDumpFunction function, void *opaque) {
+	PacketAccountingEntry **entries;
+	int count = 0;
+	HashTableIterator iterator;
+	PacketAccountingEntry *entry;
+	int i;
+
+	entries = malloc(sizeof(PacketAccountingEntry *) * MAX(accounting->entries.count, 1));
+
+	if (entries == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	hash_table_iterator_init(&iterator);
+
+	while ((entry = hash_table_iterate(&accounting->entries, &iterator)) != NULL) {
+		entries[count++] = entry;
+	}
+
+	qsort(entries, count, sizeof(PacketAccountingEntry *),
+	      packet_accounting_compare_entries);
+
+	for (i = 0; i < count; ++i) {
+		function(entries[i], opaque);
+	}
+
+	if (accounting->overflowed) {
+		function(&accounting->overflow, opaque);
+	}
+
+	free(entries);
+
+	return 0;
+}
+
+static void packet_accounting_log_entry(PacketAccountingEntry *entry, void *opaque) {
+	PacketAccountingLogState *state = opaque;
+	char base58[BASE58_MAX_LENGTH];
+
+	(void)base58; // only used if logging is compiled in
+
+	if (entry == &state->accounting->overflow) {
+		log_info("Other: requests: %" PRIu64 " (%" PRIu64 " bytes), responses: %" PRIu64
+		         ", callbacks: %" PRIu64 " (%" PRIu64 " bytes), errors: %" PRIu64,
+		         entry->requests, entry->request_bytes, entry->responses,
+		         entry->callbacks, entry->response_bytes, entry->errors);
+
+		return;
+	}
+
+	if (state->remaining <= 0) {
+		return;
+	}
+
+	--state->remaining;
+
+	log_info("U: %s, F: %u, requests: %" PRIu64 " (%" PRIu64 " bytes), responses: %" PRIu64
+	         ", callbacks: %" PRIu64 " (%" PRIu64 " bytes), errors: %" PRIu64,
+	         base58_encode(base58, entry->uid), entry->function_id,
+	         entry->requests, entry->request_bytes, entry->responses,
+	         entry->callbacks, entry->response_bytes, entry->errors);
+}
+
+// logs the MAX_LINES (> 0) entries with the most bytes, plus the overflow
+// entry if there was an overflow
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_accounting_log(PacketAccounting *accounting, int max_lines) {
+	PacketAccountingLogState state;
+
+	log_info("Packet accounting for %d uid and function ID pair(s)%s",
+	         accounting->entries.count, accounting->overflowed ? ", table is full" : "");
+
+	state.accounting = accounting;
+	state.remaining = max_lines;
+
+	if (packet_accounting_dump(accounting, packet_accounting_log_entry, &state) < 0) {
+		log_error("Could not dump packet accounting: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_accounting.h: Per UID and function ID packet traffic accounting
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PACKET_ACCOUNTING_H
+#define DAEMONLIB_PACKET_ACCOUNTING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hash_table.h"
+#include "packet.h"
+
+typedef struct {
+	uint32_t uid; // host byte order
+	uint8_t function_id;
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t callbacks;
+	uint64_t errors; // responses with an error code other than success
+	uint64_t request_bytes;
+	uint64_t response_bytes; // including callbacks
+} PacketAccountingEntry;
+
+typedef void (*PacketAccountingDumpFunction)(PacketAccountingEntry *entry, void *opaque);
+
+typedef struct {
+	HashTable entries; // maps uid and function ID to a PacketAccountingEntry
+	int max_entries;
+	PacketAccountingEntry overflow; // traffic that didn't fit into the table
+	bool overflowed;
+} PacketAccounting;
+
+int packet_accounting_create(PacketAccounting *accounting, int max_entries);
+void packet_accounting_destroy(PacketAccounting *accounting);
+
+void packet_accounting_add_request(PacketAccounting *accounting, Packet *request);
+void packet_accounting_add_response(PacketAccounting *accounting, Packet *response);
+
+int packet_accounting_reset(PacketAccounting *accounting);
+
+int packet_accounting_dump(PacketAccounting *accounting,
+                           PacketAccountingDumpFunction function, void *opaque);
+int packet_accounting_log(PacketAccounting *accounting, int max_lines);
+
+#endif // DAEMONLIB_PACKET_ACCOUNTING_H
@@ -0,0 +1,146 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader.c: Reassembles packets from a stream based I/O
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a PacketReader object owns a receive buffer for a stream based IO object
+ * such as a socket. each call to packet_reader_read fills as much of the
+ * buffer as the IO object has data available in a single io_read call. then
+ * packet_reader_next is called repeatedly to extract all complete packets
+ * from the buffer, validating each header on the way.
+ *
+ * the packets are handed out as pointers into the buffer instead of copying
+ * them. such a pointer stays valid until the next packet_reader_read call,
+ * which moves a trailing partial packet to the start of the buffer before
+ * reading more data. only the first header.length bytes of such a packet
+ * belong to it, the following bytes are part of the next packet. therefore,
+ * the packet has to be copied if it should be modified beyond its length, for
+ * example to store a trace ID in its optional data.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_reader.h"
+
+// creates a PacketReader object for IO with a buffer of SIZE (>= sizeof(Packet))
+// bytes. the header of each packet is checked with the VALIDATE function.
+//
+// returns -1 on error (sets errno) or 0 on success
+int packet_reader_create(PacketReader *reader, IO *io, int size,
+                         PacketReaderValidateFunction validate) {
+	if (size < (int)sizeof(Packet)) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	// allocate slack behind the buffer, so that a Packet pointer to a short
+	// packet at the end of the buffer doesn't point past the allocated memory
+	reader->buffer = calloc(1, size + sizeof(Packet));
+
+	if (reader->buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	reader->io = io;
+	reader->validate = validate;
+	reader->size = size;
+	reader->start = 0;
+	reader->end = 0;
+
+	return 0;
+}
+
+void packet_reader_destroy(PacketReader *reader) {
+	free(reader->buffer);
+}
+
+// reads as much data as available from the IO object into the buffer, using a
+// single io_read call. this invalidates all packets previously returned by
+// packet_reader_next. the buffered packets have to be extracted by calling
+// packet_reader_next until it returns 0 before calling this again. otherwise
+// the buffer might still be full and this fails with ENOBUFS.
+//
+// returns -1 on error (sets errno), 0 on end-of-file, IO_CONTINUE if the IO
+// object consumed data without producing any, or the number of bytes read
+int packet_reader_read(PacketReader *reader) {
+	int length;
+
+	if (reader->start > 0) {
+		length = reader->end - reader->start;
+
+		if (length > 0) {
+			memmove(reader->buffer, reader->buffer + reader->start, length);
+		}
+
+		reader->start = 0;
+		reader->end = length;
+	}
+
+	// don't call io_read with a length of 0, its result of 0 would look like
+	// end-of-file to the caller
+	if (reader->end >= reader->size) {
+		errno = ENOBUFS;
+
+		return -1;
+	}
+
+	length = io_read(reader->io, reader->buffer + reader->end,
+	                 reader->size - reader->end);
+
+	if (length > 0) {
+		reader->end += length;
+	}
+
+	return length;
+}
+
+// extracts the next complete packet from the buffer and stores a pointer to
+// it in PACKET. if its header is invalid then a description of the problem is
+// stored in MESSAGE. in this case the stream cannot be resynchronized and the
+// IO object should be closed.
+//
+// returns -1 if the next packet is invalid, 0 if there is no complete packet
+// in the buffer or 1 if a packet was extracted
+int packet_reader_next(PacketReader *reader, Packet **packet, const char **message) {
+	int available = reader->end - reader->start;
+	PacketHeader *header = (PacketHeader *)(reader->buffer + reader->start);
+
+	if (available < (int)sizeof(PacketHeader)) {
+		return 0;
+	}
+
+	if (!reader->validate(header, message)) {
+		return -1;
+	}
+
+	if (available < header->length) {
+		return 0;
+	}
+
+	*packet = (Packet *)header;
+	reader->start += header->length;
+
+	return 1;
+}
@@ -0,0 +1,49 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader.h: Reassembles packets from a stream based I/O
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PACKET_READER_H
+#define DAEMONLIB_PACKET_READER_H
+
+#include <stdint.h>
+
+#include "io.h"
+#include "packet.h"
+
+// same signature as packet_header_is_valid_request/response
+typedef int (*PacketReaderValidateFunction)(PacketHeader *header, const char **message);
+
+typedef struct {
+	IO *io;
+	PacketReaderValidateFunction validate;
+	uint8_t *buffer;
+	int size; // size of the buffer in bytes, excluding slack
+	int start; // offset of the first unconsumed byte
+	int end; // offset after the last received byte
+} PacketReader;
+
+int packet_reader_create(PacketReader *reader, IO *io, int size,
+                         PacketReaderValidateFunction validate);
+void packet_reader_destroy(PacketReader *reader);
+
+int packet_reader_read(PacketReader *reader);
+int packet_reader_next(PacketReader *reader, Packet **packet, const char **message);
+
+#endif // DAEMONLIB_PACKET_READER_H
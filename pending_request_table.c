@@ -0,0 +1,211 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pending_request_table.c: Table of pending requests for response matching
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a PendingRequestTable object keeps track of requests that are waiting for a
+ * response. a response matches a request if uid, function ID and sequence
+ * number are equal, as checked by packet_is_matching_response. instead of
+ * comparing a response to each pending request, the pending requests are
+ * stored in a HashTable using uid, function ID and sequence number as key.
+ * this makes routing a response back to its request O(1), regardless of the
+ * number of pending requests.
+ *
+ * multiple requests can have the same key, for example if two clients call
+ * the same function of the same device. the requests with the same key are
+ * kept in an LRUList, so the oldest one is matched first. additionally, all
+ * requests are kept in another LRUList ordered by their age, so requests that
+ * didn't get a response in time can be expired without scanning the table.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pending_request_table.h"
+
+#include "macros.h"
+#include "utils.h"
+
+typedef struct {
+	PendingRequest request;
+	Node key_node; // requests with the same key, oldest first
+	Node age_node; // all requests, oldest first
+} PendingRequestEntry;
+
+static uint64_t pending_request_table_get_key(PacketHeader *header) {
+	return (uint64_t)header->uid |
+	       (uint64_t)header->function_id << 32 |
+	       (uint64_t)packet_header_get_sequence_number(header) << 40;
+}
+
+// removes ENTRY from the table and frees it
+static void pending_request_table_remove(PendingRequestTable *table,
+                                         PendingRequestEntry *entry) {
+	uint64_t key = pending_request_table_get_key(&entry->request.header);
+	LRUList *requests = hash_table_get_integer(&table->keys, key);
+
+	lru_list_remove(requests, &entry->key_node);
+
+	if (requests->count == 0) {
+		hash_table_remove_integer(&table->keys, key, NULL);
+	}
+
+	lru_list_remove(&table->ages, &entry->age_node);
+
+	--table->count;
+
+	free(entry);
+}
+
+// creates an empty PendingRequestTable object
+//
+// returns -1 on error (sets errno) or 0 on success
+int pending_request_table_create(PendingRequestTable *table) {
+	if (hash_table_create(&table->keys, 0, sizeof(LRUList),
+	                      HASH_TABLE_KEY_TYPE_INTEGER) < 0) {
+		return -1;
+	}
+
+	lru_list_create(&table->ages);
+
+	table->count = 0;
+
+	return 0;
+}
+
+// destroys a PendingRequestTable object. if a destroy function DESTROY is
+// given then it is called for each pending request before it is freed.
+void pending_request_table_destroy(PendingRequestTable *table,
+                                   PendingRequestFunction destroy) {
+	Node *node;
+	PendingRequestEntry *entry;
+
+	while ((node = lru_list_pop_oldest(&table->ages)) != NULL) {
+		entry = containerof(node, PendingRequestEntry, age_node);
+
+		if (destroy != NULL) {
+			destroy(&entry->request);
+		}
+
+		free(entry);
+	}
+
+	hash_table_destroy(&table->keys, NULL);
+}
+
+// adds a request given by its HEADER to a PendingRequestTable object. OPAQUE
+// is stored along with it and handed back when the request gets matched or
+// expires.
+//
+// returns -1 on error (sets errno) or 0 on success
+int pending_request_table_insert(PendingRequestTable *table,
+                                 PacketHeader *header, void *opaque) {
+	uint64_t key = pending_request_table_get_key(header);
+	LRUList *requests;
+	PendingRequestEntry *entry = malloc(sizeof(PendingRequestEntry));
+
+	if (entry == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	requests = hash_table_get_integer(&table->keys, key);
+
+	if (requests == NULL) {
+		requests = hash_table_insert_integer(&table->keys, key);
+
+		if (requests == NULL) {
+			free(entry);
+
+			return -1;
+		}
+
+		lru_list_create(requests);
+	}
+
+	memcpy(&entry->request.header, header, sizeof(PacketHeader));
+
+	entry->request.opaque = opaque;
+	entry->request.timestamp = microseconds();
+
+	lru_list_insert(requests, &entry->key_node);
+	lru_list_insert(&table->ages, &entry->age_node);
+
+	++table->count;
+
+	return 0;
+}
+
+// looks up the oldest pending request matching the RESPONSE header. if found
+// the pending request is removed from a PendingRequestTable object and copied
+// to REQUEST.
+//
+// returns true if a matching pending request was found, false otherwise
+bool pending_request_table_match(PendingRequestTable *table,
+                                 PacketHeader *response, PendingRequest *request) {
+	LRUList *requests = hash_table_get_integer(&table->keys,
+	                                           pending_request_table_get_key(response));
+	PendingRequestEntry *entry;
+
+	if (requests == NULL) {
+		return false;
+	}
+
+	entry = containerof(lru_list_peek_oldest(requests), PendingRequestEntry, key_node);
+
+	memcpy(request, &entry->request, sizeof(PendingRequest));
+
+	pending_request_table_remove(table, entry);
+
+	return true;
+}
+
+// removes all pending requests that are older than MAX_AGE microseconds from a
+// PendingRequestTable object. if an expire function EXPIRE is given then it is
+// called for each expired request before it is removed.
+//
+// returns the number of expired requests
+int pending_request_table_expire(PendingRequestTable *table, uint64_t max_age,
+                                 PendingRequestFunction expire) {
+	uint64_t now = microseconds();
+	Node *node;
+	PendingRequestEntry *entry;
+	int expired = 0;
+
+	while ((node = lru_list_peek_oldest(&table->ages)) != NULL) {
+		entry = containerof(node, PendingRequestEntry, age_node);
+
+		if (now - entry->request.timestamp <= max_age) {
+			break; // all following requests are younger
+		}
+
+		if (expire != NULL) {
+			expire(&entry->request);
+		}
+
+		pending_request_table_remove(table, entry);
+
+		++expired;
+	}
+
+	return expired;
+}
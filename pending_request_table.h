@@ -0,0 +1,57 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pending_request_table.h: Table of pending requests for response matching
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PENDING_REQUEST_TABLE_H
+#define DAEMONLIB_PENDING_REQUEST_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hash_table.h"
+#include "lru_list.h"
+#include "packet.h"
+
+typedef struct {
+	PacketHeader header; // header of the pending request
+	void *opaque; // user data, for example the client that sent the request
+	uint64_t timestamp; // microseconds, time of insertion
+} PendingRequest;
+
+typedef void (*PendingRequestFunction)(PendingRequest *request);
+
+typedef struct {
+	HashTable keys; // maps uid, function ID and sequence number to an LRUList
+	LRUList ages; // all pending requests, oldest first
+	int count; // number of pending requests
+} PendingRequestTable;
+
+int pending_request_table_create(PendingRequestTable *table);
+void pending_request_table_destroy(PendingRequestTable *table,
+                                   PendingRequestFunction destroy);
+
+int pending_request_table_insert(PendingRequestTable *table,
+                                 PacketHeader *header, void *opaque);
+bool pending_request_table_match(PendingRequestTable *table,
+                                 PacketHeader *response, PendingRequest *request);
+int pending_request_table_expire(PendingRequestTable *table, uint64_t max_age,
+                                 PendingRequestFunction expire);
+
+#endif // DAEMONLIB_PENDING_REQUEST_TABLE_H
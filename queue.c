@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2013-2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2013-2014, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * queue.c: Queue specific functions
  *
@@ -24,60 +24,159 @@
  * to its tail and to remove items from its head. in contrast to an Array object
  * there is no need for special handling of non-relocatable items because an
  * item is never moved in memory during Queue operations.
+ *
+ * the nodes of removed items are kept in a QueueNodePool object for reuse by
+ * queue_push, up to a limit. by default each Queue object has its own pool,
+ * but a pool can also be shared between Queue objects that store items of the
+ * same size. this avoids memory allocation for the nodes of a Queue object in
+ * steady state. memory referenced by the items themselves is not covered by
+ * this and needs its own reuse scheme, as done for SharedPacket objects.
  */
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "queue.h"
 
+#define DEFAULT_MAX_POOLED_NODES 32
+
 // returns a pointer to the item stored at the given QueueNode
 static void *queue_node_get_item(QueueNode *node) {
 	return (uint8_t *)node + sizeof(QueueNode);
 }
 
-// creates an empty (count == 0) Queue object. each item is SIZE (> 0) bytes
-// in size.
-//
-// returns -1 on error (sets errno) or 0 on success
-int queue_create(Queue *queue, int size) {
-	queue->count = 0;
-	queue->size = size;
-	queue->head = NULL;
-	queue->tail = NULL;
+// returns the node pool of a Queue object. the own pool is not referenced by
+// pointer to keep Queue objects relocatable in memory
+static QueueNodePool *queue_get_pool(Queue *queue) {
+	return queue->pool != NULL ? queue->pool : &queue->own_pool;
+}
 
-	return 0;
+// returns NULL on error (sets errno) or a new node on success
+static QueueNode *queue_node_pool_allocate(QueueNodePool *pool) {
+	QueueNode *node = pool->free;
+
+	if (node != NULL) {
+		pool->free = node->next;
+
+		--pool->count;
+
+		if (pool->zero_on_reuse) {
+			memset(queue_node_get_item(node), 0, pool->size);
+		}
+	} else {
+		node = calloc(1, sizeof(QueueNode) + pool->size);
+
+		if (node == NULL) {
+			errno = ENOMEM;
+
+			return NULL;
+		}
+	}
+
+	return node;
 }
 
-// destroys a Queue object and frees the underlying single linked list. if an
-// item destroy function DESTROY is given then it is called for each item in the
-// queue (with a pointer to the item as the only parameter) before the memory
-// is freed.
-void queue_destroy(Queue *queue, ItemDestroyFunction destroy) {
-	QueueNode *node;
+// releases a chain of nodes starting at the given NODE to a QueueNodePool
+// object. if an item destroy function DESTROY is given then it is called for
+// each item in the chain. nodes exceeding the pool's limit are freed
+static void queue_node_pool_release(QueueNodePool *pool, QueueNode *node,
+                                    ItemDestroyFunction destroy) {
 	QueueNode *next;
 
-	for (node = queue->head; node != NULL; node = next) {
+	for (; node != NULL; node = next) {
 		next = node->next;
 
 		if (destroy != NULL) {
 			destroy(queue_node_get_item(node));
 		}
 
-		free(node);
+		if (pool->count < pool->max_count) {
+			node->next = pool->free;
+			pool->free = node;
+
+			++pool->count;
+		} else {
+			free(node);
+		}
 	}
 }
 
+// creates an empty QueueNodePool object for nodes storing items of SIZE (> 0)
+// bytes. up to MAX_COUNT (>= 0) nodes are kept for reuse. if ZERO_ON_REUSE is
+// true then the memory of reused items is initialized to zero, otherwise the
+// items returned by queue_push for a pooled Queue object contain the content
+// of a previously removed item and the caller has to initialize them.
+//
+// returns -1 on error (sets errno) or 0 on success
+int queue_node_pool_create(QueueNodePool *pool, int size, int max_count,
+                           bool zero_on_reuse) {
+	pool->size = size;
+	pool->count = 0;
+	pool->max_count = max_count;
+	pool->zero_on_reuse = zero_on_reuse;
+	pool->free = NULL;
+
+	return 0;
+}
+
+// destroys a QueueNodePool object and frees all nodes kept for reuse. all
+// Queue objects using this pool have to be destroyed before.
+void queue_node_pool_destroy(QueueNodePool *pool) {
+	pool->max_count = 0;
+
+	queue_node_pool_release(pool, pool->free, NULL);
+}
+
+// creates an empty (count == 0) Queue object with its own node pool. each item
+// is SIZE (> 0) bytes in size.
+//
+// returns -1 on error (sets errno) or 0 on success
+int queue_create(Queue *queue, int size) {
+	queue->count = 0;
+	queue->size = size;
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->pool = NULL;
+
+	return queue_node_pool_create(&queue->own_pool, size,
+	                              DEFAULT_MAX_POOLED_NODES, true);
+}
+
+// creates an empty (count == 0) Queue object that uses the given shared node
+// POOL. each item is as big as specified by the pool. the pool has to outlive
+// the Queue object.
+//
+// returns -1 on error (sets errno) or 0 on success
+int queue_create_pooled(Queue *queue, QueueNodePool *pool) {
+	queue->count = 0;
+	queue->size = pool->size;
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->pool = pool;
+
+	// the own pool is unused, but keep it in a valid state
+	return queue_node_pool_create(&queue->own_pool, pool->size, 0, true);
+}
+
+// destroys a Queue object and releases the underlying single linked list. if
+// an item destroy function DESTROY is given then it is called for each item in
+// the queue (with a pointer to the item as the only parameter) before the
+// memory is released.
+void queue_destroy(Queue *queue, ItemDestroyFunction destroy) {
+	queue_node_pool_release(queue_get_pool(queue), queue->head, destroy);
+	queue_node_pool_destroy(&queue->own_pool);
+}
+
 // adds a new item to the tail of a Queue object. the memory of this item is
-// initialized to zero.
+// initialized to zero, unless the Queue object uses a node pool that doesn't
+// zero reused items.
 //
 // returns NULL on error (sets errno) or a pointer to the new item on success
 void *queue_push(Queue *queue) {
-	QueueNode *node = calloc(1, sizeof(QueueNode) + queue->size);
+	QueueNode *node = queue_node_pool_allocate(queue_get_pool(queue));
 
 	if (node == NULL) {
-		errno = ENOMEM;
-
 		return NULL;
 	}
 
@@ -117,11 +216,9 @@ void queue_pop(Queue *queue, ItemDestroyFunction destroy) {
 		queue->tail = NULL;
 	}
 
-	if (destroy != NULL) {
-		destroy(queue_node_get_item(node));
-	}
+	node->next = NULL;
 
-	free(node);
+	queue_node_pool_release(queue_get_pool(queue), node, destroy);
 }
 
 // returns a pointer to the item at the head of a Queue object or NULL if the
@@ -133,3 +230,86 @@ void *queue_peek(Queue *queue) {
 
 	return queue_node_get_item(queue->head);
 }
+
+// removes up to COUNT (>= 0) items from the head of a Queue object. if an item
+// destroy function DESTROY is given then it is called for each removed item
+// (with a pointer to the item as the only parameter) before it is removed.
+//
+// returns the number of removed items
+int queue_pop_n(Queue *queue, int count, ItemDestroyFunction destroy) {
+	QueueNode *first;
+	QueueNode *last;
+	int i;
+
+	if (count >= queue->count) {
+		count = queue->count;
+
+		queue_clear(queue, destroy);
+
+		return count;
+	}
+
+	if (count <= 0) {
+		return 0;
+	}
+
+	// detach the first COUNT nodes as one chain and free it in one go
+	first = queue->head;
+	last = first;
+
+	for (i = 1; i < count; ++i) {
+		last = last->next;
+	}
+
+	queue->head = last->next;
+	queue->count -= count;
+
+	last->next = NULL;
+
+	queue_node_pool_release(queue_get_pool(queue), first, destroy);
+
+	return count;
+}
+
+// removes all items from a Queue object. if an item destroy function DESTROY
+// is given then it is called for each item (with a pointer to the item as the
+// only parameter) before it is removed.
+void queue_clear(Queue *queue, ItemDestroyFunction destroy) {
+	queue_node_pool_release(queue_get_pool(queue), queue->head, destroy);
+
+	queue->count = 0;
+	queue->head = NULL;
+	queue->tail = NULL;
+}
+
+// moves all items from an OTHER Queue object to the tail of a Queue object
+// without copying them. afterwards OTHER is empty. both Queue objects have to
+// store items of the same size and have to be different objects.
+//
+// returns -1 on error (sets errno) or 0 on success
+int queue_splice(Queue *queue, Queue *other) {
+	if (queue == other || queue->size != other->size) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	if (other->count == 0) {
+		return 0;
+	}
+
+	if (queue->tail != NULL) {
+		queue->tail->next = other->head;
+	} else {
+		queue->head = other->head;
+	}
+
+	queue->tail = other->tail;
+	queue->count += other->count;
+
+	other->count = 0;
+	other->head = NULL;
+	other->tail = NULL;
+
+	return 0;
+}
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2013 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2013, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * queue.h: Queue specific functions
  *
@@ -22,6 +22,7 @@
 #ifndef DAEMONLIB_QUEUE_H
 #define DAEMONLIB_QUEUE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "utils.h"
@@ -32,18 +33,37 @@ struct _QueueNode {
 	QueueNode *next;
 };
 
+typedef struct {
+	int size; // size of a single item in bytes
+	int count; // number of nodes kept for reuse
+	int max_count; // maximum number of nodes kept for reuse
+	bool zero_on_reuse; // true if items are initialized to zero on reuse
+	QueueNode *free;
+} QueueNodePool;
+
 typedef struct {
 	int count; // number of items in the queue
 	int size; // size of a single item in bytes
 	QueueNode *head;
 	QueueNode *tail;
+	QueueNodePool *pool; // NULL if own_pool is used, otherwise a shared pool
+	QueueNodePool own_pool;
 } Queue;
 
+int queue_node_pool_create(QueueNodePool *pool, int size, int max_count,
+                           bool zero_on_reuse);
+void queue_node_pool_destroy(QueueNodePool *pool);
+
 int queue_create(Queue *queue, int size);
+int queue_create_pooled(Queue *queue, QueueNodePool *pool);
 void queue_destroy(Queue *queue, ItemDestroyFunction destroy);
 
 void *queue_push(Queue *queue);
 void queue_pop(Queue *queue, ItemDestroyFunction destroy);
+int queue_pop_n(Queue *queue, int count, ItemDestroyFunction destroy);
+void queue_clear(Queue *queue, ItemDestroyFunction destroy);
 void *queue_peek(Queue *queue);
 
+int queue_splice(Queue *queue, Queue *other);
+
 #endif // DAEMONLIB_QUEUE_H
@@ -0,0 +1,125 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * shared_packet.c: Reference counted immutable packet buffer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a SharedPacket object stores a copy of a packet that can be referenced by
+ * multiple owners at the same time. this allows to send the same packet to
+ * many recipients without having to copy it for each of them. the content
+ * of a SharedPacket object must not be modified after it was created.
+ *
+ * the reference count is not protected against concurrent access, therefore
+ * a SharedPacket object must only be used from a single thread, typically
+ * the event loop thread.
+ *
+ * SharedPacket objects for packets of up to POOLED_CAPACITY bytes are kept in
+ * a free list after their last reference got removed and are reused by
+ * shared_packet_create. a Writer with a backlog creates and releases one per
+ * queued packet, this way a backed-up Writer doesn't allocate in steady state.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared_packet.h"
+
+#define POOLED_CAPACITY 128 // bytes, enough for all TFP packets
+#define MAX_POOLED_COUNT 256
+
+typedef union _SharedPacketPoolEntry SharedPacketPoolEntry;
+
+union _SharedPacketPoolEntry {
+	SharedPacketPoolEntry *next;
+	SharedPacket shared_packet;
+};
+
+static SharedPacketPoolEntry *_pool = NULL;
+static int _pool_count = 0;
+
+// creates a SharedPacket object with a reference count of 1 and copies LENGTH
+// (>= 0) bytes from DATA into it
+//
+// returns NULL on error (sets errno) or a pointer to the new object on success
+SharedPacket *shared_packet_create(const void *data, int length) {
+	SharedPacket *shared_packet;
+
+	if (length <= POOLED_CAPACITY && _pool != NULL) {
+		shared_packet = &_pool->shared_packet;
+		_pool = _pool->next;
+
+		--_pool_count;
+	} else {
+		// packets that fit the pool always get the full pooled capacity, so
+		// that they can be reused for any other packet that fits the pool
+		shared_packet = malloc(sizeof(SharedPacketPoolEntry) +
+		                       (length <= POOLED_CAPACITY ? POOLED_CAPACITY : length));
+
+		if (shared_packet == NULL) {
+			errno = ENOMEM;
+
+			return NULL;
+		}
+	}
+
+	shared_packet->reference_count = 1;
+	shared_packet->length = length;
+
+	memcpy(shared_packet_get_data(shared_packet), data, length);
+
+	return shared_packet;
+}
+
+// adds a reference to a SharedPacket object
+//
+// returns the given SharedPacket object
+SharedPacket *shared_packet_acquire(SharedPacket *shared_packet) {
+	++shared_packet->reference_count;
+
+	return shared_packet;
+}
+
+// removes a reference from a SharedPacket object. the object is freed if the
+// last reference is removed
+void shared_packet_release(SharedPacket *shared_packet) {
+	SharedPacketPoolEntry *entry;
+
+	if (--shared_packet->reference_count > 0) {
+		return;
+	}
+
+	if (shared_packet->length > POOLED_CAPACITY || _pool_count >= MAX_POOLED_COUNT) {
+		free(shared_packet);
+
+		return;
+	}
+
+	entry = (SharedPacketPoolEntry *)shared_packet;
+	entry->next = _pool;
+	_pool = entry;
+
+	++_pool_count;
+}
+
+// returns a pointer to the packet data stored in a SharedPacket object
+void *shared_packet_get_data(SharedPacket *shared_packet) {
+	return (uint8_t *)shared_packet + sizeof(SharedPacketPoolEntry);
+}
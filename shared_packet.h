@@ -0,0 +1,36 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * shared_packet.h: Reference counted immutable packet buffer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_SHARED_PACKET_H
+#define DAEMONLIB_SHARED_PACKET_H
+
+typedef struct {
+	int reference_count;
+	int length; // number of bytes stored after the SharedPacket struct
+} SharedPacket;
+
+SharedPacket *shared_packet_create(const void *data, int length);
+SharedPacket *shared_packet_acquire(SharedPacket *shared_packet);
+void shared_packet_release(SharedPacket *shared_packet);
+
+void *shared_packet_get_data(SharedPacket *shared_packet);
+
+#endif // DAEMONLIB_SHARED_PACKET_H
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2014, 2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2014, 2017-2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * signal.c: Signal specific functions
  *
@@ -26,6 +26,7 @@
 
 #include "event.h"
 #include "log.h"
+#include "packet.h"
 #include "pipe.h"
 #include "utils.h"
 
@@ -67,6 +68,10 @@ static void signal_handle(void *opaque) {
 		if (_handle_sigusr1 != NULL) {
 			_handle_sigusr1();
 		}
+	} else if (signal_number == SIGUSR2) {
+		log_info("Received SIGUSR2");
+
+		packet_trace_set_enabled(!packet_trace_is_enabled());
 	} else {
 		log_warn("Received unexpected signal %d", signal_number);
 	}
@@ -149,8 +154,22 @@ int signal_init(SIGHUPFunction sighup, SIGUSR1Function sigusr1) {
 
 	phase = 7;
 
+	// handle SIGUSR2 to toggle packet tracing
+	if (signal(SIGUSR2, signal_forward) == SIG_ERR) {
+		log_error("Could not install signal handler for SIGUSR2: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 8;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 7:
+		signal(SIGUSR1, SIG_DFL);
+		// fall through
+
 	case 6:
 		signal(SIGHUP, SIG_DFL);
 		// fall through
@@ -179,10 +198,11 @@ cleanup:
 		break;
 	}
 
-	return phase == 7 ? 0 : -1;
+	return phase == 8 ? 0 : -1;
 }
 
 void signal_exit(void) {
+	signal(SIGUSR2, SIG_DFL);
 	signal(SIGUSR1, SIG_DFL);
 	signal(SIGHUP, SIG_DFL);
 	signal(SIGPIPE, SIG_DFL);
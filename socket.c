@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2014-2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2014-2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * socket.c: Socket implementation
  *
@@ -38,6 +38,8 @@ extern int socket_accept_platform(Socket *socket, Socket *accepted_socket,
                                   struct sockaddr *address, socklen_t *length);
 extern int socket_listen_platform(Socket *socket, int backlog);
 extern int socket_receive_platform(Socket *socket, void *buffer, int length);
+extern int socket_receive_vector_platform(Socket *socket, SocketBuffer *buffers, int count);
+extern int socket_receive_datagrams_platform(Socket *socket, SocketBuffer *buffers, int count);
 extern int socket_send_platform(Socket *socket, const void *buffer, int length);
 
 static const char *socket_get_address_family_name(int family, bool dual_stack) {
@@ -68,6 +70,7 @@ int socket_create(Socket *socket) {
 	socket->destroy = socket_destroy_platform;
 	socket->receive = socket_receive_platform;
 	socket->send = socket_send_platform;
+	socket->pending_error = 0;
 
 	return 0;
 }
@@ -140,6 +143,118 @@ int socket_receive(Socket *socket, void *buffer, int length) {
 	return socket->receive(socket, buffer, length);
 }
 
+// receives data from a stream socket into up to SOCKET_MAX_RECEIVE_BUFFERS of
+// the COUNT BUFFERS, filling one buffer after the other. the number of bytes
+// received into each buffer is stored in its received member. normally this
+// is done with a single system call. but if the receive function of the
+// socket got overridden, then it is called once per buffer instead, until a
+// buffer is not filled completely.
+//
+// returns -1 on error (sets errno), 0 on end-of-file or the total number of
+// bytes received
+int socket_receive_vector(Socket *socket, SocketBuffer *buffers, int count) {
+	int i;
+	int length;
+	int total = 0;
+
+	count = MIN(count, SOCKET_MAX_RECEIVE_BUFFERS);
+
+	for (i = 0; i < count; ++i) {
+		buffers[i].received = 0;
+	}
+
+	if (socket->receive != socket_receive_platform) {
+		for (i = 0; i < count; ++i) {
+			length = socket_receive(socket, buffers[i].buffer, buffers[i].length);
+
+			if (length < 0) {
+				// report the data received so far, the error will show up
+				// again on the next call
+				return total > 0 ? total : length;
+			}
+
+			buffers[i].received = length;
+			total += length;
+
+			if (length < buffers[i].length) {
+				break;
+			}
+		}
+
+		return total;
+	}
+
+	total = socket_receive_vector_platform(socket, buffers, count);
+
+	if (total <= 0) {
+		return total;
+	}
+
+	length = total;
+
+	for (i = 0; i < count && length > 0; ++i) {
+		buffers[i].received = MIN(length, buffers[i].length);
+		length -= buffers[i].received;
+	}
+
+	return total;
+}
+
+// receives up to COUNT (<= SOCKET_MAX_RECEIVE_BUFFERS) datagrams from a
+// datagram socket, one datagram per buffer. the length of each received
+// datagram is stored in the received member of its buffer. on Linux this is
+// done with a single recvmmsg call. on other platforms, or if the receive
+// function of the socket got overridden, the socket is received from once per
+// datagram until no more datagrams are pending. if an error occurs after at
+// least one datagram was received then the datagrams are returned and the
+// error is reported by the next call, as recvmmsg does.
+//
+// returns -1 on error (sets errno) or the number of received datagrams
+int socket_receive_datagrams(Socket *socket, SocketBuffer *buffers, int count) {
+	int i;
+	int length;
+
+	if (socket->pending_error != 0) {
+		errno = socket->pending_error;
+		socket->pending_error = 0;
+
+		return -1;
+	}
+
+	count = MIN(count, SOCKET_MAX_RECEIVE_BUFFERS);
+
+	if (socket->receive == socket_receive_platform) {
+		i = socket_receive_datagrams_platform(socket, buffers, count);
+
+		if (i >= 0 || errno != ENOSYS) {
+			return i;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		length = socket_receive(socket, buffers[i].buffer, buffers[i].length);
+
+		if (length < 0) {
+			if (i == 0) {
+				return -1;
+			}
+
+			// asynchronous errors such as ECONNREFUSED are consumed by the
+			// failed receive call. keep the error for the next call instead
+			// of losing it while reporting the datagrams received so far
+			if (!errno_would_block()) {
+				socket->pending_error = errno;
+			}
+
+			return i;
+		}
+
+		buffers[i].received = length;
+	}
+
+	return count;
+}
+
 // sets errno on error
 int socket_send(Socket *socket, const void *buffer, int length) {
 	if (socket->send == NULL) {
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * socket.h: Socket specific functions
@@ -33,6 +33,14 @@
 
 #include "io.h"
 
+#define SOCKET_MAX_RECEIVE_BUFFERS 64
+
+typedef struct {
+	void *buffer;
+	int length; // size of the buffer in bytes
+	int received; // number of bytes received into the buffer
+} SocketBuffer;
+
 typedef struct _Socket Socket;
 
 typedef Socket *(*SocketCreateAllocatedFunction)(void);
@@ -49,6 +57,7 @@ struct _Socket {
 	SocketDestroyFunction destroy;
 	SocketReceiveFunction receive;
 	SocketSendFunction send;
+	int pending_error; // reported by the next socket_receive_datagrams call
 };
 
 // FIXME: maybe merge socket_create and socket_open
@@ -66,6 +75,8 @@ int socket_listen(Socket *socket, int backlog,
 int socket_connect(Socket *socket, struct sockaddr *address, int length);
 
 int socket_receive(Socket *socket, void *buffer, int length);
+int socket_receive_vector(Socket *socket, SocketBuffer *buffers, int count);
+int socket_receive_datagrams(Socket *socket, SocketBuffer *buffers, int count);
 int socket_send(Socket *socket, const void *buffer, int length);
 
 int socket_set_address_reuse(Socket *socket, bool address_reuse);
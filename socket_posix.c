@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * socket_posix.c: POSIX based socket implementation
@@ -20,6 +20,12 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#ifdef __linux__
+	#ifndef _GNU_SOURCE
+		#define _GNU_SOURCE // for recvmmsg
+	#endif
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -27,6 +33,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "socket.h"
@@ -138,6 +145,63 @@ int socket_receive_platform(Socket *socket, void *buffer, int length) {
 	return recv(socket->handle, buffer, length, 0);
 }
 
+// sets errno on error
+int socket_receive_vector_platform(Socket *socket, SocketBuffer *buffers, int count) {
+	struct iovec iov[SOCKET_MAX_RECEIVE_BUFFERS];
+	struct msghdr message;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		iov[i].iov_base = buffers[i].buffer;
+		iov[i].iov_len = buffers[i].length;
+	}
+
+	memset(&message, 0, sizeof(message));
+
+	message.msg_iov = iov;
+	message.msg_iovlen = count;
+
+	return recvmsg(socket->handle, &message, 0);
+}
+
+// sets errno on error, sets errno to ENOSYS if recvmmsg is not available
+int socket_receive_datagrams_platform(Socket *socket, SocketBuffer *buffers, int count) {
+#ifdef __linux__
+	struct iovec iov[SOCKET_MAX_RECEIVE_BUFFERS];
+	struct mmsghdr messages[SOCKET_MAX_RECEIVE_BUFFERS];
+	int i;
+	int received;
+
+	memset(messages, 0, sizeof(struct mmsghdr) * count);
+
+	for (i = 0; i < count; ++i) {
+		iov[i].iov_base = buffers[i].buffer;
+		iov[i].iov_len = buffers[i].length;
+
+		messages[i].msg_hdr.msg_iov = &iov[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// the socket is non-blocking, so this returns as soon as no more
+	// datagrams are pending. fails with ENOSYS on kernels before 2.6.33
+	received = recvmmsg(socket->handle, messages, count, 0, NULL);
+
+	for (i = 0; i < received; ++i) {
+		buffers[i].received = messages[i].msg_len;
+	}
+
+	return received;
+#else
+	(void)socket;
+	(void)buffers;
+	(void)count;
+
+	errno = ENOSYS;
+
+	return -1;
+#endif
+}
+
 // sets errno on error
 int socket_send_platform(Socket *socket, const void *buffer, int length) {
 #ifdef MSG_NOSIGNAL
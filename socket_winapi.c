@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * socket_winapi.c: WinAPI based socket implementation
@@ -158,6 +158,38 @@ int socket_receive_platform(Socket *socket, void *buffer, int length) {
 	return length;
 }
 
+// sets errno on error
+int socket_receive_vector_platform(Socket *socket, SocketBuffer *buffers, int count) {
+	WSABUF wsa_buffers[SOCKET_MAX_RECEIVE_BUFFERS];
+	DWORD length;
+	DWORD flags = 0;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		wsa_buffers[i].buf = (char *)buffers[i].buffer;
+		wsa_buffers[i].len = buffers[i].length;
+	}
+
+	if (WSARecv(socket->handle, wsa_buffers, count, &length, &flags, NULL, NULL) == SOCKET_ERROR) {
+		errno = ERRNO_WINAPI_OFFSET + WSAGetLastError();
+
+		return -1;
+	}
+
+	return length;
+}
+
+// sets errno to ENOSYS, there is no recvmmsg equivalent
+int socket_receive_datagrams_platform(Socket *socket, SocketBuffer *buffers, int count) {
+	(void)socket;
+	(void)buffers;
+	(void)count;
+
+	errno = ENOSYS;
+
+	return -1;
+}
+
 // sets errno on error
 int socket_send_platform(Socket *socket, const void *buffer, int length) {
 	length = send(socket->handle, (const char *)buffer, length, 0);
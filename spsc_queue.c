@@ -0,0 +1,146 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * spsc_queue.c: Lock-free single-producer single-consumer queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * an SPSCQueue object is a bounded ring buffer that allows exactly one thread
+ * (the producer) to add items to its tail while exactly one other thread (the
+ * consumer) removes items from its head, without locks or system calls. in
+ * contrast to a Queue object the items are copied into the ring buffer on
+ * push, because an item must not become visible to the consumer before it is
+ * completely written.
+ *
+ * the queue does not notify the consumer about new items. the consumer has to
+ * poll the queue or the producer has to notify it by other means, for example
+ * by writing to a pipe once after pushing a batch of items.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_queue.h"
+
+#include "atomic.h"
+
+// creates an empty SPSCQueue object that can store at least CAPACITY (> 0)
+// items. each item is SIZE (> 0) bytes in size.
+//
+// returns -1 on error (sets errno) or 0 on success
+int spsc_queue_create(SPSCQueue *queue, int capacity, int size) {
+	int rounded = 1;
+
+	if (capacity <= 0 || capacity > (1 << 30)) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	// round capacity up to the next power of two to be able to use the free
+	// running head and tail counters as indices by masking them
+	while (rounded < capacity) {
+		rounded *= 2;
+	}
+
+	queue->capacity = rounded;
+	queue->size = size;
+	queue->bytes = calloc(rounded, size);
+	queue->head = 0;
+	queue->tail = 0;
+
+	if (queue->bytes == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// destroys an SPSCQueue object and frees the underlying memory. if an item
+// destroy function DESTROY is given then it is called for each item in the
+// queue (with a pointer to the item as the only parameter) before the memory
+// is freed. neither the producer nor the consumer can use the queue anymore
+// at this point.
+void spsc_queue_destroy(SPSCQueue *queue, ItemDestroyFunction destroy) {
+	if (destroy != NULL) {
+		while (spsc_queue_peek(queue) != NULL) {
+			spsc_queue_pop(queue, destroy);
+		}
+	}
+
+	free(queue->bytes);
+}
+
+// copies ITEM to the tail of an SPSCQueue object. must only be called by the
+// producer.
+//
+// returns -1 if the queue is full (sets errno to EAGAIN) or 0 on success
+int spsc_queue_push(SPSCQueue *queue, const void *item) {
+	uint32_t tail = atomic_load_relaxed(&queue->tail);
+	uint32_t head = atomic_load_acquire(&queue->head);
+
+	if (tail - head >= (uint32_t)queue->capacity) {
+		errno = EAGAIN;
+
+		return -1;
+	}
+
+	memcpy(queue->bytes + queue->size * (tail & (queue->capacity - 1)), item, queue->size);
+
+	// make the item visible to the consumer
+	atomic_store_release(&queue->tail, tail + 1);
+
+	return 0;
+}
+
+// removes the item from the head of an SPSCQueue object. if an item destroy
+// function DESTROY is given then it is called (with a pointer to the item as
+// the only parameter) before it is removed. must only be called by the
+// consumer.
+void spsc_queue_pop(SPSCQueue *queue, ItemDestroyFunction destroy) {
+	uint32_t head = atomic_load_relaxed(&queue->head);
+	void *item = spsc_queue_peek(queue);
+
+	if (item == NULL) {
+		return;
+	}
+
+	if (destroy != NULL) {
+		destroy(item);
+	}
+
+	// give the slot back to the producer
+	atomic_store_release(&queue->head, head + 1);
+}
+
+// returns a pointer to the item at the head of an SPSCQueue object or NULL if
+// the queue is empty. the item stays valid until it is removed by the consumer.
+// must only be called by the consumer.
+void *spsc_queue_peek(SPSCQueue *queue) {
+	uint32_t head = atomic_load_relaxed(&queue->head);
+	uint32_t tail = atomic_load_acquire(&queue->tail);
+
+	if (head == tail) {
+		return NULL;
+	}
+
+	return queue->bytes + queue->size * (head & (queue->capacity - 1));
+}
@@ -0,0 +1,49 @@
+/*
+ * daemonlib
+ * Copyright (C) 2018 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * spsc_queue.h: Lock-free single-producer single-consumer queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_SPSC_QUEUE_H
+#define DAEMONLIB_SPSC_QUEUE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+#define SPSC_QUEUE_CACHE_LINE_SIZE 64
+
+typedef struct {
+	int capacity; // maximum number of items in the queue, power of two
+	int size; // size of a single item in bytes
+	uint8_t *bytes;
+	uint8_t padding1[SPSC_QUEUE_CACHE_LINE_SIZE];
+	uint32_t head; // only written by the consumer
+	uint8_t padding2[SPSC_QUEUE_CACHE_LINE_SIZE];
+	uint32_t tail; // only written by the producer
+	uint8_t padding3[SPSC_QUEUE_CACHE_LINE_SIZE];
+} SPSCQueue;
+
+int spsc_queue_create(SPSCQueue *queue, int capacity, int size);
+void spsc_queue_destroy(SPSCQueue *queue, ItemDestroyFunction destroy);
+
+int spsc_queue_push(SPSCQueue *queue, const void *item);
+void spsc_queue_pop(SPSCQueue *queue, ItemDestroyFunction destroy);
+void *spsc_queue_peek(SPSCQueue *queue);
+
+#endif // DAEMONLIB_SPSC_QUEUE_H
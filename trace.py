@@ -3,6 +3,8 @@
 
 import sys
 import struct
+import argparse
+import collections
 
 if sys.hexversion < 0x03040000:
     print('Python 3.4 required')
@@ -20,29 +22,57 @@ def base58encode(value):
 
     return BASE58[value] + encoded
 
-def main():
-    path = sys.argv[1]
-
-    with open(path, 'rb') as f:
-        data = f.read()
-
+def read_traces(f):
+    # yields (trace_id, timestamp, packet, filename, line) for each enhanced
+    # packet block of a pcapng file written by packet_trace_flush
+    while True:
+        head = f.read(8)
+
+        if len(head) < 8:
+            return
+
+        block_type, block_length = struct.unpack('<II', head)
+        body = f.read(block_length - 8)
+
+        if block_type != 6: # enhanced packet block
+            continue
+
+        _, timestamp_high, timestamp_low, captured_length, _ = struct.unpack_from('<IIIII', body, 0)
+        timestamp = (timestamp_high << 32) | timestamp_low
+        packet = body[20:20 + captured_length]
+        offset = 20 + (captured_length + 3) // 4 * 4
+        trace_id = 0
+        filename = '<unknown>'
+        line = -1
+
+        while offset + 4 <= len(body) - 4:
+            code, length = struct.unpack_from('<HH', body, offset)
+            value = body[offset + 4:offset + 4 + length]
+            offset += 4 + (length + 3) // 4 * 4
+
+            if code == 0: # end of options
+                break
+            elif code == 1: # comment
+                filename, _, line = value.decode('utf-8').rpartition(':')
+                line = int(line)
+            elif code == 5: # packet ID
+                trace_id = struct.unpack('<Q', value)[0]
+
+        yield trace_id, timestamp, packet, filename, line
+
+def unpack_header(packet):
+    # returns (uid, length, function_id, sequence_number, response_expected, error_code)
+    uid, length, function_id, sequence_number_and_options, error_code_and_future_use \
+      = struct.unpack_from('<IBBBB', packet, 0)
+
+    return uid, length, function_id, sequence_number_and_options >> 4, \
+           (sequence_number_and_options >> 3) & 1, error_code_and_future_use >> 6
+
+def print_traces(f):
     last_timestamp = None
 
-    while len(data) > 0:
-        trace_id, timestamp, header_uid, header_length, header_function_id, \
-          header_sequence_number_and_options, header_error_code_and_future_use \
-          = struct.unpack_from('<QQIBBBB', data, 0)
-
-        data = data[24:]
-
-        i = data.find(b'\0')
-        filename = data[:i].decode('utf-8')
-
-        data = data[i + 1:]
-
-        line = struct.unpack_from('<i', data, 0)[0]
-
-        data = data[4:]
+    for trace_id, timestamp, packet, filename, line in read_traces(f):
+        uid, length, function_id, sequence_number, response_expected, error_code = unpack_header(packet)
 
         if last_timestamp == None:
             last_timestamp = timestamp
@@ -51,16 +81,111 @@ def main():
               .format(trace_id,
                       timestamp,
                       timestamp - last_timestamp,
-                      base58encode(header_uid),
-                      header_length,
-                      header_function_id,
-                      header_sequence_number_and_options >> 4,
-                      (header_sequence_number_and_options >> 2) & 1,
-                      header_error_code_and_future_use >> 6,
+                      base58encode(uid),
+                      length,
+                      function_id,
+                      sequence_number,
+                      response_expected,
+                      error_code,
                       filename,
                       line))
 
         last_timestamp = timestamp
 
+def percentile(values, p):
+    # nearest-rank percentile of the sorted list VALUES
+    return values[max(0, min(len(values) - 1, (len(values) * p + 99) // 100 - 1))]
+
+def print_latencies(title, latencies, format_key):
+    print('{}:'.format(title))
+    print('  {:<40} {:>8} {:>10} {:>10} {:>10} {:>10}'.format('', 'count', 'p50 [us]', 'p90 [us]', 'p99 [us]', 'max [us]'))
+
+    for key, values in sorted(latencies.items(), key=lambda item: -len(item[1])):
+        values.sort()
+
+        print('  {:<40} {:8d} {:10d} {:10d} {:10d} {:10d}'
+              .format(format_key(key), len(values), percentile(values, 50),
+                      percentile(values, 90), percentile(values, 99), values[-1]))
+
+    print('')
+
+def analyze_traces(f, max_tracked):
+    # requests have even trace IDs, responses and callbacks have odd ones. a
+    # response is joined with the oldest pending request for the same UID,
+    # function ID and sequence number, as in packet_is_matching_response.
+    # consecutive records with the same trace ID are hops of a packet through
+    # the code, the time between them is attributed to the source locations
+    pending = collections.OrderedDict() # (uid, function_id, sequence_number) -> [timestamp]
+    last_seen = collections.OrderedDict() # trace_id -> (timestamp, location)
+    per_function = collections.defaultdict(list)
+    per_uid = collections.defaultdict(list)
+    per_hop = collections.defaultdict(list)
+    record_count = 0
+    unassigned_count = 0
+    unmatched_responses = 0
+
+    for trace_id, timestamp, packet, filename, line in read_traces(f):
+        uid, _, function_id, sequence_number, response_expected, _ = unpack_header(packet)
+        location = '{}:{}'.format(filename, line)
+        record_count += 1
+
+        if trace_id == 0:
+            # trace ID 0 means unassigned, such records can't be related to
+            # each other and would be chained into bogus hops
+            unassigned_count += 1
+            continue
+
+        if trace_id in last_seen:
+            last_timestamp, last_location = last_seen.pop(trace_id)
+            per_hop[(last_location, location)].append(timestamp - last_timestamp)
+        else:
+            # first record of this packet, join responses with their request
+            key = (uid, function_id, sequence_number)
+
+            if trace_id % 2 == 0:
+                if response_expected and sequence_number != 0:
+                    pending.setdefault(key, collections.deque()).append(timestamp)
+
+                    if len(pending) > max_tracked:
+                        pending.popitem(last=False)
+            elif sequence_number != 0:
+                requests = pending.get(key)
+
+                if requests:
+                    latency = timestamp - requests.popleft()
+
+                    if not requests:
+                        del pending[key]
+
+                    per_function[function_id].append(latency)
+                    per_uid[uid].append(latency)
+                else:
+                    unmatched_responses += 1
+
+        last_seen[trace_id] = (timestamp, location)
+
+        if len(last_seen) > max_tracked:
+            last_seen.popitem(last=False)
+
+    print('{} records, {} without trace ID, {} unanswered requests, {} unmatched responses\n'
+          .format(record_count, unassigned_count, sum(len(requests) for requests in pending.values()), unmatched_responses))
+
+    print_latencies('Round-trip latency by function ID', per_function, str)
+    print_latencies('Round-trip latency by UID', per_uid, base58encode)
+    print_latencies('Time between source locations', per_hop, lambda hop: '{} -> {}'.format(*hop))
+
+def main():
+    parser = argparse.ArgumentParser(description='Print or analyze a packet trace file')
+    parser.add_argument('--latency', action='store_true', help='report latency percentiles instead of printing the records')
+    parser.add_argument('--max-tracked', type=int, default=100000, help='limit for pending requests and packets in flight')
+    parser.add_argument('path')
+    args = parser.parse_args()
+
+    with open(args.path, 'rb') as f:
+        if args.latency:
+            analyze_traces(f, args.max_tracked)
+        else:
+            print_traces(f)
+
 if __name__ == '__main__':
     main()
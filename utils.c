@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2015, 2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2015, 2017-2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * utils.c: Utility functions
@@ -451,6 +451,14 @@ uint32_t uint32_to_le(uint32_t native) {
 	return c.little;
 }
 
+// convert from little endian to host endian
+uint16_t uint16_from_le(uint16_t value) {
+	uint8_t *bytes = (uint8_t *)&value;
+
+	return ((uint16_t)bytes[1] << 8) |
+	       ((uint16_t)bytes[0] << 0);
+}
+
 // convert from little endian to host endian
 uint32_t uint32_from_le(uint32_t value) {
 	uint8_t *bytes = (uint8_t *)&value;
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2012-2015, 2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2012-2015, 2017-2018 Matthias Bolte <matthias@tinkerforge.com>
  * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
  *
  * utils.h: Utility functions
@@ -49,6 +49,7 @@ int parse_int(const char *string, char **end_ptr, int base, int *value);
 uint16_t uint16_to_le(uint16_t native);
 uint32_t uint32_to_le(uint32_t native);
 
+uint16_t uint16_from_le(uint16_t value);
 uint32_t uint32_from_le(uint32_t value);
 
 void millisleep(uint32_t milliseconds);
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2014, 2017 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2014, 2017-2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * writer.c: Buffered packet writer for I/O devices
  *
@@ -20,7 +20,6 @@
  */
 
 #include <errno.h>
-#include <string.h>
 
 #include "writer.h"
 
@@ -31,9 +30,59 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define MAX_QUEUED_WRITES 32768
 
+static int writer_get_packet_length(void *packet) {
+	return ((Packet *)packet)->header.length;
+}
+
+#ifdef DAEMONLIB_WITH_LOGGING
+
+// formats the signature of PACKET with the packet signature function that was
+// given to writer_create or writer_create_generic. only used for logging
+static char *writer_get_packet_signature(Writer *writer, char *signature, void *packet) {
+	if (writer->typed_packet_signature != NULL) {
+		return writer->typed_packet_signature(signature, packet);
+	}
+
+	return writer->packet_signature(signature, packet);
+}
+
+#endif
+
+static void writer_destroy_partial_packet(void *item) {
+	PartialPacket *partial_packet = item;
+
+	shared_packet_release(partial_packet->shared_packet);
+}
+
+// called after items got removed from the backlog
+static void writer_check_backlog_low(Writer *writer) {
+	if (writer->backlog_above_high_watermark &&
+	    writer->backlog.count <= writer->backlog_low_watermark) {
+		writer->backlog_above_high_watermark = false;
+
+		if (writer->on_backlog_low != NULL) {
+			writer->on_backlog_low(writer->opaque);
+		}
+	}
+}
+
+// called after an item got added to the backlog
+static void writer_check_backlog_high(Writer *writer) {
+	if (!writer->backlog_above_high_watermark &&
+	    writer->backlog_high_watermark > 0 &&
+	    writer->backlog.count >= writer->backlog_high_watermark) {
+		writer->backlog_above_high_watermark = true;
+
+		if (writer->on_backlog_high != NULL) {
+			writer->on_backlog_high(writer->opaque);
+		}
+	}
+}
+
 static void writer_handle_write(void *opaque) {
 	Writer *writer = opaque;
 	PartialPacket *partial_packet;
+	void *packet;
 	void *remaining_data;
 	int remaining_length;
 	int rc;
@@ -46,8 +95,9 @@ static void writer_handle_write(void *opaque) {
 
 	// write remaining packet data
 	partial_packet = queue_peek(&writer->backlog);
-	remaining_data = (uint8_t *)&partial_packet->packet + partial_packet->written;
-	remaining_length = (int)partial_packet->packet.header.length - partial_packet->written;
+	packet = shared_packet_get_data(partial_packet->shared_packet);
+	remaining_data = (uint8_t *)packet + partial_packet->written;
+	remaining_length = partial_packet->shared_packet->length - partial_packet->written;
 
 	if (remaining_length > 0) {
 		rc = io_write(writer->io, remaining_data, remaining_length);
@@ -55,7 +105,7 @@ static void writer_handle_write(void *opaque) {
 		if (rc < 0) {
 			log_error("Could not send queued %s (%s) to %s, disconnecting %s: %s (%d)",
 			          writer->packet_type,
-			          writer->packet_signature(packet_signature, &partial_packet->packet),
+			          writer_get_packet_signature(writer, packet_signature, packet),
 			          writer->recipient_signature(recipient_signature, false, writer->opaque),
 			          writer->recipient_name,
 			          get_errno_name(errno), errno);
@@ -69,27 +119,33 @@ static void writer_handle_write(void *opaque) {
 	}
 
 	// if packet was no completely written then don't remove it from the backlog yet
-	if (partial_packet->written < (int)partial_packet->packet.header.length) {
+	if (partial_packet->written < partial_packet->shared_packet->length) {
 		return;
 	}
 
 	log_packet_debug("Sent queued %s (%s) to %s, %d %s(s) left in write backlog",
 	                 writer->packet_type,
-	                 writer->packet_signature(packet_signature, &partial_packet->packet),
+	                 writer_get_packet_signature(writer, packet_signature, packet),
 	                 writer->recipient_signature(recipient_signature, false, writer->opaque),
 	                 writer->backlog.count - 1,
 	                 writer->packet_type);
 
-	queue_pop(&writer->backlog, NULL);
+	queue_pop(&writer->backlog, writer_destroy_partial_packet);
 
 	if (writer->backlog.count == 0) {
 		// last queued packet handled, deregister for write events
 		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
 		                    EVENT_WRITE, 0, NULL, NULL);
 	}
+
+	writer_check_backlog_low(writer);
 }
 
-static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int written) {
+// if SHARED_PACKET is not NULL then PACKET has to be its data and a reference
+// to it is pushed to the backlog, otherwise LENGTH bytes of PACKET are copied
+// to the backlog
+static int writer_push_packet_to_backlog(Writer *writer, void *packet, int length,
+                                         SharedPacket *shared_packet, int written) {
 	PartialPacket *queued_partial_packet;
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
@@ -109,8 +165,23 @@ static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int wri
 
 		writer->dropped_packets += packets_to_drop;
 
-		while (writer->backlog.count >= MAX_QUEUED_WRITES) {
-			queue_pop(&writer->backlog, NULL);
+		queue_pop_n(&writer->backlog, packets_to_drop, writer_destroy_partial_packet);
+	}
+
+	if (shared_packet != NULL) {
+		shared_packet_acquire(shared_packet);
+	} else {
+		shared_packet = shared_packet_create(packet, length);
+
+		if (shared_packet == NULL) {
+			log_error("Could not copy %s (%s) for write backlog for %s, discarding %s: %s (%d)",
+			          writer->packet_type,
+			          writer_get_packet_signature(writer, packet_signature, packet),
+			          writer->recipient_signature(recipient_signature, false, writer->opaque),
+			          writer->packet_type,
+			          get_errno_name(errno), errno);
+
+			return -1;
 		}
 	}
 
@@ -119,15 +190,17 @@ static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int wri
 	if (queued_partial_packet == NULL) {
 		log_error("Could not push %s (%s) to write backlog for %s, discarding %s: %s (%d)",
 		          writer->packet_type,
-		          writer->packet_signature(packet_signature, packet),
+		          writer_get_packet_signature(writer, packet_signature, packet),
 		          writer->recipient_signature(recipient_signature, false, writer->opaque),
 		          writer->packet_type,
 		          get_errno_name(errno), errno);
 
+		shared_packet_release(shared_packet);
+
 		return -1;
 	}
 
-	memcpy(&queued_partial_packet->packet, packet, packet->header.length);
+	queued_partial_packet->shared_packet = shared_packet;
 	queued_partial_packet->written = written;
 
 	if (writer->backlog.count == 1) {
@@ -139,6 +212,8 @@ static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int wri
 		}
 	}
 
+	writer_check_backlog_high(writer);
+
 	return 0;
 }
 
@@ -149,14 +224,43 @@ int writer_create(Writer *writer, IO *io,
                   WriterRecipientSignatureFunction recipient_signature,
                   WriterRecipientDisconnectFunction recipient_disconnect,
                   void *opaque) {
+	if (writer_create_generic(writer, io, packet_type, writer_get_packet_length,
+	                          NULL, recipient_name, recipient_signature,
+	                          recipient_disconnect, opaque) < 0) {
+		return -1;
+	}
+
+	writer->typed_packet_signature = packet_signature;
+
+	return 0;
+}
+
+// creates a Writer object for packets of any format, e.g. mesh packets. the
+// PACKET_LENGTH function has to return the total length of a given packet in
+// bytes. the packet signature functions gets passed a pointer to such packet
+int writer_create_generic(Writer *writer, IO *io,
+                          const char *packet_type,
+                          WriterPacketLengthFunction packet_length,
+                          WriterGenericPacketSignatureFunction packet_signature,
+                          const char *recipient_name,
+                          WriterRecipientSignatureFunction recipient_signature,
+                          WriterRecipientDisconnectFunction recipient_disconnect,
+                          void *opaque) {
 	writer->io = io;
 	writer->packet_type = packet_type;
+	writer->packet_length = packet_length;
 	writer->packet_signature = packet_signature;
+	writer->typed_packet_signature = NULL;
 	writer->recipient_name = recipient_name;
 	writer->recipient_signature = recipient_signature;
 	writer->recipient_disconnect = recipient_disconnect;
 	writer->opaque = opaque;
 	writer->dropped_packets = 0;
+	writer->backlog_low_watermark = 0;
+	writer->backlog_high_watermark = 0;
+	writer->backlog_above_high_watermark = false;
+	writer->on_backlog_high = NULL;
+	writer->on_backlog_low = NULL;
 
 	// create write queue
 	if (queue_create(&writer->backlog, sizeof(PartialPacket)) < 0) {
@@ -182,19 +286,18 @@ void writer_destroy(Writer *writer) {
 		                    EVENT_WRITE, 0, NULL, NULL);
 	}
 
-	queue_destroy(&writer->backlog, NULL);
+	queue_destroy(&writer->backlog, writer_destroy_partial_packet);
 }
 
-// returns -1 on error, 0 if the packet was completely written and 1 if the
-// packet was completely or partly pushed to the backlog
-int writer_write(Writer *writer, Packet *packet) {
+static int writer_write_packet(Writer *writer, void *packet, int length,
+                               SharedPacket *shared_packet) {
 	int rc;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
 
 	// there is already a backlog, push complete packet to backlog
 	if (writer->backlog.count > 0) {
-		if (writer_push_packet_to_backlog(writer, packet, 0) < 0) {
+		if (writer_push_packet_to_backlog(writer, packet, length, shared_packet, 0) < 0) {
 			return -1;
 		}
 
@@ -202,12 +305,12 @@ int writer_write(Writer *writer, Packet *packet) {
 	}
 
 	// if there is no backlog, try to write
-	rc = io_write(writer->io, packet, packet->header.length);
+	rc = io_write(writer->io, packet, length);
 
 	if (rc < 0) {
 		if (errno_would_block()) {
 			// if write failed with EWOULDBLOCK, push complete packet to backlog
-			if (writer_push_packet_to_backlog(writer, packet, 0) < 0) {
+			if (writer_push_packet_to_backlog(writer, packet, length, shared_packet, 0) < 0) {
 				return -1;
 			}
 
@@ -217,7 +320,7 @@ int writer_write(Writer *writer, Packet *packet) {
 		// otherwise give up and disconnect the recipient
 		log_error("Could not send %s (%s) to %s, disconnecting %s: %s (%d)",
 		          writer->packet_type,
-		          writer->packet_signature(packet_signature, packet),
+		          writer_get_packet_signature(writer, packet_signature, packet),
 		          writer->recipient_signature(recipient_signature, false, writer->opaque),
 		          writer->recipient_name,
 		          get_errno_name(errno), errno);
@@ -225,9 +328,9 @@ int writer_write(Writer *writer, Packet *packet) {
 		writer->recipient_disconnect(writer->opaque);
 
 		return -1;
-	} else if (rc < packet->header.length) {
+	} else if (rc < length) {
 		// packet was not written completely, push remaining packet to backlog
-		if (writer_push_packet_to_backlog(writer, packet, rc) < 0) {
+		if (writer_push_packet_to_backlog(writer, packet, length, shared_packet, rc) < 0) {
 			return -1;
 		}
 
@@ -236,3 +339,58 @@ int writer_write(Writer *writer, Packet *packet) {
 
 	return 0;
 }
+
+// enables flow control for the backlog of a Writer object. if the number of
+// packets in the backlog reaches HIGH (> 0 and <= 32768) then ON_BACKLOG_HIGH
+// is called. once the backlog has been drained to LOW (>= 0 and < HIGH) again
+// then ON_BACKLOG_LOW is called. both functions get passed the opaque pointer
+// of the writer and are called alternately. this allows the caller to stop
+// producing packets for a slow recipient, instead of having them dropped once
+// the backlog is full. use HIGH = 0 to disable flow control again, this
+// calls the current ON_BACKLOG_LOW function if the backlog is above the
+// current high watermark
+//
+// returns -1 on error (sets errno) or 0 on success
+int writer_set_backlog_watermarks(Writer *writer, int low, int high,
+                                  WriterBacklogFunction on_backlog_high,
+                                  WriterBacklogFunction on_backlog_low) {
+	if (high < 0 || high > MAX_QUEUED_WRITES || (high > 0 && (low < 0 || low >= high))) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	if (high == 0 && writer->backlog_above_high_watermark) {
+		// release a producer that is currently waiting for the backlog to drain
+		writer->backlog_above_high_watermark = false;
+
+		if (writer->on_backlog_low != NULL) {
+			writer->on_backlog_low(writer->opaque);
+		}
+	}
+
+	writer->backlog_low_watermark = low;
+	writer->backlog_high_watermark = high;
+	writer->on_backlog_high = on_backlog_high;
+	writer->on_backlog_low = on_backlog_low;
+
+	// the backlog might already be above the new high watermark
+	writer_check_backlog_high(writer);
+
+	return 0;
+}
+
+// returns -1 on error, 0 if the packet was completely written and 1 if the
+// packet was completely or partly pushed to the backlog
+int writer_write(Writer *writer, void *packet) {
+	return writer_write_packet(writer, packet, writer->packet_length(packet), NULL);
+}
+
+// same as writer_write, but instead of copying the packet to the backlog a
+// reference to SHARED_PACKET is pushed to it. this allows to send the same
+// packet to many recipients while only storing it once in memory. the caller
+// keeps its own reference and has to release it as usual
+int writer_write_shared(Writer *writer, SharedPacket *shared_packet) {
+	return writer_write_packet(writer, shared_packet_get_data(shared_packet),
+	                           shared_packet->length, shared_packet);
+}
@@ -1,6 +1,6 @@
 /*
  * daemonlib
- * Copyright (C) 2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2014, 2018 Matthias Bolte <matthias@tinkerforge.com>
  *
  * writer.h: Buffered packet writer for I/O devices
  *
@@ -27,32 +27,41 @@
 #include "io.h"
 #include "packet.h"
 #include "queue.h"
+#include "shared_packet.h"
 
 #define WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH 256
 
+typedef int (*WriterPacketLengthFunction)(void *packet);
+typedef char *(*WriterGenericPacketSignatureFunction)(char *signature, void *packet);
 typedef char *(*WriterPacketSignatureFunction)(char *signature, Packet *packet);
 typedef char *(*WriterRecipientSignatureFunction)(char *signature, bool upper, void *opaque);
 typedef void (*WriterRecipientDisconnectFunction)(void *opaque);
+typedef void (*WriterBacklogFunction)(void *opaque);
 
 typedef struct {
-	Packet packet;
+	SharedPacket *shared_packet;
 	int written;
 } PartialPacket;
 
 typedef struct {
 	IO *io;
 	const char *packet_type; // for display purpose
-	WriterPacketSignatureFunction packet_signature;
+	WriterPacketLengthFunction packet_length;
+	WriterGenericPacketSignatureFunction packet_signature;
+	WriterPacketSignatureFunction typed_packet_signature; // set by writer_create
 	const char *recipient_name; // for display purpose
 	WriterRecipientSignatureFunction recipient_signature;
 	WriterRecipientDisconnectFunction recipient_disconnect;
 	void *opaque;
 	uint32_t dropped_packets;
 	Queue backlog;
+	int backlog_low_watermark;
+	int backlog_high_watermark;
+	bool backlog_above_high_watermark;
+	WriterBacklogFunction on_backlog_high;
+	WriterBacklogFunction on_backlog_low;
 } Writer;
 
-// FIXME: rework this to work for mesh packets as well
-
 int writer_create(Writer *writer, IO *io,
                   const char *packet_type,
                   WriterPacketSignatureFunction packet_signature,
@@ -60,8 +69,21 @@ int writer_create(Writer *writer, IO *io,
                   WriterRecipientSignatureFunction recipient_signature,
                   WriterRecipientDisconnectFunction recipient_disconnect,
                   void *opaque);
+int writer_create_generic(Writer *writer, IO *io,
+                          const char *packet_type,
+                          WriterPacketLengthFunction packet_length,
+                          WriterGenericPacketSignatureFunction packet_signature,
+                          const char *recipient_name,
+                          WriterRecipientSignatureFunction recipient_signature,
+                          WriterRecipientDisconnectFunction recipient_disconnect,
+                          void *opaque);
 void writer_destroy(Writer *writer);
 
-int writer_write(Writer *writer, Packet *packet);
+int writer_set_backlog_watermarks(Writer *writer, int low, int high,
+                                  WriterBacklogFunction on_backlog_high,
+                                  WriterBacklogFunction on_backlog_low);
+
+int writer_write(Writer *writer, void *packet);
+int writer_write_shared(Writer *writer, SharedPacket *shared_packet);
 
 #endif // DAEMONLIB_WRITER_H